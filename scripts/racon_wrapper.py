@@ -22,7 +22,6 @@ class RaconWrapper:
         self.subsampled_sequences = None
         self.overlaps = os.path.abspath(overlaps)
         self.target_sequences = os.path.abspath(target_sequences)
-        self.split_target_sequences = []
         self.chunk_size = split
         self.reference_length, self.coverage = subsample if subsample is not None\
             else (None, None)
@@ -83,40 +82,6 @@ class RaconWrapper:
         else:
             self.subsampled_sequences = self.sequences
 
-        if (self.chunk_size is not None):
-            try:
-                p = subprocess.Popen([RaconWrapper.__rampler, '-o', self.work_directory,
-                    'split', self.target_sequences, self.chunk_size])
-            except OSError:
-                eprint('[RaconWrapper::run] error: unable to run rampler!')
-                sys.exit(1)
-            p.communicate()
-            if (p.returncode != 0):
-                sys.exit(1)
-
-            base_name = os.path.basename(self.target_sequences).split('.')[0]
-            extension = '.fasta' if (self.target_sequences.endswith('.fasta') or\
-                self.target_sequences.endswith('.fasta.gz') or\
-                self.target_sequences.endswith('.fa') or\
-                self.target_sequences.endswith('.fa.gz')) else\
-                '.fastq'
-
-            i = 0
-            while (True):
-                target_sequences_part = os.path.join(self.work_directory, base_name) +\
-                    '_' + str(i) + extension
-                if (not os.path.isfile(target_sequences_part)):
-                    break
-                self.split_target_sequences.append(target_sequences_part)
-                i += 1
-            eprint('[RaconWrapper::run] total number of splits: ' + str(i))
-
-            if (len(self.split_target_sequences) == 0):
-                eprint('[RaconWrapper::run] error: unable to find split target sequences!')
-                sys.exit(1)
-        else:
-            self.split_target_sequences.append(self.target_sequences)
-
         racon_params = [RaconWrapper.__racon]
         if (self.include_unpolished == True): racon_params.append('-u')
         if (self.fragment_correction == True): racon_params.append('-f')
@@ -127,28 +92,28 @@ class RaconWrapper:
             '-x', str(self.mismatch),
             '-g', str(self.gap),
             '-t', str(self.threads)])
+        if (self.chunk_size is not None):
+            racon_params.extend(['--split', str(self.chunk_size)])
         if (@racon_wrapper_enable_cuda@):
             if (self.cuda_banded_alignment == True): racon_params.append('-b')
             racon_params.extend([
                 '--cudaaligner-band-width', str(self.cudaaligner_band_width),
                 '--cudaaligner-batches', str(self.cudaaligner_batches),
                 '-c', str(self.cudapoa_batches)])
-        racon_params.extend([self.subsampled_sequences, self.overlaps, ""])
+        racon_params.extend([self.subsampled_sequences, self.overlaps,
+            self.target_sequences])
 
-        for target_sequences_part in self.split_target_sequences:
-            eprint('[RaconWrapper::run] processing data with racon')
-            racon_params[-1] = target_sequences_part
-            try:
-                p = subprocess.Popen(racon_params)
-            except OSError:
-                eprint('[RaconWrapper::run] error: unable to run racon!')
-                sys.exit(1)
-            p.communicate()
-            if (p.returncode != 0):
-                sys.exit(1)
+        eprint('[RaconWrapper::run] processing data with racon')
+        try:
+            p = subprocess.Popen(racon_params)
+        except OSError:
+            eprint('[RaconWrapper::run] error: unable to run racon!')
+            sys.exit(1)
+        p.communicate()
+        if (p.returncode != 0):
+            sys.exit(1)
 
         self.subsampled_sequences = None
-        self.split_target_sequences = []
 
 #*******************************************************************************
 
@@ -0,0 +1,346 @@
+/*!
+ * @file bam_parser.cpp
+ *
+ * @brief BamParser class source file
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <future>
+
+#include "overlap.hpp"
+#include "cigar.hpp"
+#include "bam_parser.hpp"
+
+#include "thread_pool/thread_pool.hpp"
+#include "zlib.h"
+
+namespace racon {
+
+constexpr uint32_t kBatchSize = 256; // BGZF blocks, ~ 16MB decompressed
+constexpr uint32_t kBgzfFixedHeaderSize = 12;
+constexpr uint32_t kBgzfFooterSize = 8;
+constexpr uint32_t kRecordHeaderSize = 32;
+
+// BAM is little-endian
+uint32_t readUint32(const char* src) {
+    const unsigned char* s = reinterpret_cast<const unsigned char*>(src);
+    return s[0] | s[1] << 8 | s[2] << 16 | static_cast<uint32_t>(s[3]) << 24;
+}
+
+uint32_t readUint16(const char* src) {
+    const unsigned char* s = reinterpret_cast<const unsigned char*>(src);
+    return s[0] | s[1] << 8;
+}
+
+void inflateBlock(const std::vector<unsigned char>& block, std::vector<char>& dst,
+    const std::string& path) {
+
+    const char* footer = reinterpret_cast<const char*>(&block[block.size() -
+        kBgzfFooterSize]);
+    uint32_t crc = readUint32(footer);
+    dst.resize(readUint32(footer + 4));
+    if (dst.empty()) {
+        return;
+    }
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    bool is_valid = inflateInit2(&stream, -15) == Z_OK;
+    if (is_valid) {
+        stream.next_in = const_cast<Bytef*>(block.data());
+        stream.avail_in = block.size() - kBgzfFooterSize;
+        stream.next_out = reinterpret_cast<Bytef*>(dst.data());
+        stream.avail_out = dst.size();
+        is_valid = inflate(&stream, Z_FINISH) == Z_STREAM_END &&
+            stream.total_out == dst.size();
+        inflateEnd(&stream);
+    }
+    if (!is_valid || crc != crc32(crc32(0, Z_NULL, 0),
+        reinterpret_cast<const Bytef*>(dst.data()), dst.size())) {
+
+        fprintf(stderr, "[racon::BamParser::parse] error: "
+            "corrupted BGZF block in file %s!\n", path.c_str());
+        exit(1);
+    }
+}
+
+// returns the CG:B:I tag holding CIGARs longer than 65535 operations or
+// nullptr if there is none
+const char* findLongCigar(const char* tags, const char* end, uint32_t& length) {
+
+    auto type_size = [] (char type) -> uint32_t {
+        switch (type) {
+            case 'A': case 'c': case 'C': return 1;
+            case 's': case 'S': return 2;
+            case 'i': case 'I': case 'f': return 4;
+            default: return 0;
+        }
+    };
+
+    while (tags + 3 <= end) {
+        char type = tags[2];
+        const char* value = tags + 3;
+        if (type == 'Z' || type == 'H') {
+            const char* nul = static_cast<const char*>(memchr(value, '\0', end - value));
+            tags = nul == nullptr ? end : nul + 1;
+        } else if (type == 'B') {
+            if (value + 5 > end) {
+                break;
+            }
+            uint32_t count = readUint32(value + 1);
+            if (tags[0] == 'C' && tags[1] == 'G' && value[0] == 'I') {
+                length = count;
+                return value + 5;
+            }
+            tags = value + 5 + static_cast<uint64_t>(count) * type_size(value[0]);
+        } else if (type_size(type) != 0) {
+            tags = value + type_size(type);
+        } else {
+            break;
+        }
+    }
+    return nullptr;
+}
+
+std::unique_ptr<BamParser> createBamParser(const std::string& path,
+    bool keep_queries) {
+
+    FILE* input = fopen(path.c_str(), "rb");
+    if (input == nullptr) {
+        fprintf(stderr, "[racon::createBamParser] error: "
+            "unable to open file %s!\n", path.c_str());
+        exit(1);
+    }
+
+    return std::unique_ptr<BamParser>(new BamParser(input, path, keep_queries));
+}
+
+BamParser::BamParser(FILE* input, const std::string& path, bool keep_queries)
+        : input_(input), path_(path), keep_queries_(keep_queries),
+        is_eof_(false), data_(), data_begin_(0), has_header_(false),
+        references_() {
+}
+
+BamParser::~BamParser() {
+    fclose(input_);
+}
+
+void BamParser::reset() {
+    fseek(input_, 0, SEEK_SET);
+    is_eof_ = false;
+    std::vector<char>().swap(data_);
+    data_begin_ = 0;
+    has_header_ = false;
+    references_.clear();
+}
+
+bool BamParser::fill(uint64_t length,
+    const std::shared_ptr<thread_pool::ThreadPool>& thread_pool) {
+
+    if (data_.size() - data_begin_ >= length) {
+        return true;
+    }
+
+    data_.erase(data_.begin(), data_.begin() + data_begin_);
+    data_begin_ = 0;
+
+    while (data_.size() < length && !is_eof_) {
+        std::vector<std::vector<unsigned char>> blocks;
+        while (blocks.size() < kBatchSize) {
+            unsigned char header[kBgzfFixedHeaderSize];
+            size_t header_length = fread(header, 1, kBgzfFixedHeaderSize, input_);
+            if (header_length == 0) {
+                is_eof_ = true;
+                break;
+            }
+            if (header_length != kBgzfFixedHeaderSize || header[0] != 31 ||
+                header[1] != 139 || header[2] != 8 || !(header[3] & 4)) {
+                fprintf(stderr, "[racon::BamParser::parse] error: "
+                    "file %s is not BGZF compressed!\n", path_.c_str());
+                exit(1);
+            }
+
+            uint32_t extra_length = header[10] | header[11] << 8;
+            std::vector<unsigned char> extra(extra_length);
+            uint32_t block_size = 0;
+            if (fread(extra.data(), 1, extra_length, input_) == extra_length) {
+                for (uint32_t i = 0; i + 4 <= extra_length; ) {
+                    uint32_t subfield_length = extra[i + 2] | extra[i + 3] << 8;
+                    if (extra[i] == 'B' && extra[i + 1] == 'C' &&
+                        subfield_length == 2 && i + 6 <= extra_length) {
+                        block_size = (extra[i + 4] | extra[i + 5] << 8) + 1;
+                    }
+                    i += 4 + subfield_length;
+                }
+            }
+            if (block_size < kBgzfFixedHeaderSize + extra_length + kBgzfFooterSize) {
+                fprintf(stderr, "[racon::BamParser::parse] error: "
+                    "invalid BGZF block in file %s!\n", path_.c_str());
+                exit(1);
+            }
+
+            blocks.emplace_back(block_size - kBgzfFixedHeaderSize - extra_length);
+            if (fread(blocks.back().data(), 1, blocks.back().size(), input_) !=
+                blocks.back().size()) {
+                fprintf(stderr, "[racon::BamParser::parse] error: "
+                    "file %s is truncated!\n", path_.c_str());
+                exit(1);
+            }
+        }
+
+        std::vector<std::vector<char>> decompressed(blocks.size());
+        std::vector<std::future<void>> thread_futures;
+        for (uint64_t i = 0; i < blocks.size(); ++i) {
+            thread_futures.emplace_back(thread_pool->Submit(
+                [&](uint64_t j) -> void {
+                    inflateBlock(blocks[j], decompressed[j], path_);
+                }, i));
+        }
+        for (uint64_t i = 0; i < blocks.size(); ++i) {
+            thread_futures[i].wait();
+            data_.insert(data_.end(), decompressed[i].begin(), decompressed[i].end());
+        }
+    }
+
+    return data_.size() >= length;
+}
+
+void BamParser::parse_header(
+    const std::shared_ptr<thread_pool::ThreadPool>& thread_pool) {
+
+    auto require = [&] (uint64_t length) -> const char* {
+        if (!fill(length, thread_pool)) {
+            fprintf(stderr, "[racon::BamParser::parse] error: "
+                "file %s is truncated!\n", path_.c_str());
+            exit(1);
+        }
+        return &data_[data_begin_];
+    };
+
+    const char* data = require(8);
+    if (memcmp(data, "BAM\1", 4) != 0) {
+        fprintf(stderr, "[racon::BamParser::parse] error: "
+            "file %s has invalid BAM header!\n", path_.c_str());
+        exit(1);
+    }
+    uint64_t text_length = readUint32(data + 4);
+    data = require(8 + text_length + 4);
+    uint32_t num_references = readUint32(data + 8 + text_length);
+    data_begin_ += 8 + text_length + 4;
+
+    references_.reserve(num_references);
+    for (uint32_t i = 0; i < num_references; ++i) {
+        data = require(4);
+        uint32_t name_length = readUint32(data);
+        data = require(4 + name_length + 4);
+        references_.emplace_back(data + 4, name_length > 0 ? name_length - 1 : 0);
+        data_begin_ += 4 + name_length + 4;
+    }
+}
+
+std::vector<std::unique_ptr<Overlap>> BamParser::parse(uint64_t bytes,
+    const std::shared_ptr<thread_pool::ThreadPool>& thread_pool) {
+
+    if (!has_header_) {
+        parse_header(thread_pool);
+        has_header_ = true;
+    }
+
+    std::vector<std::unique_ptr<Overlap>> dst;
+    std::vector<uint32_t> cigar;
+    std::string sequence, quality;
+
+    uint64_t parsed_bytes = 0;
+    while (parsed_bytes < bytes && fill(4, thread_pool)) {
+        uint32_t record_size = readUint32(&data_[data_begin_]);
+        if (record_size < kRecordHeaderSize || !fill(4 + record_size, thread_pool)) {
+            fprintf(stderr, "[racon::BamParser::parse] error: "
+                "file %s is truncated!\n", path_.c_str());
+            exit(1);
+        }
+
+        const char* record = &data_[data_begin_ + 4];
+        const char* end = record + record_size;
+
+        int32_t reference_id = static_cast<int32_t>(readUint32(record));
+        uint32_t position = readUint32(record + 4);
+        uint32_t name_length = static_cast<unsigned char>(record[8]);
+        uint32_t cigar_length = readUint16(record + 12);
+        uint32_t flag = readUint16(record + 14);
+        uint32_t sequence_length = readUint32(record + 16);
+
+        const char* name = record + kRecordHeaderSize;
+        const char* cigar_data = name + name_length;
+        const char* sequence_data = cigar_data + 4 * cigar_length;
+        const char* quality_data = sequence_data + (sequence_length + 1) / 2;
+        const char* tags = quality_data + sequence_length;
+        if (tags > end || name_length == 0) {
+            fprintf(stderr, "[racon::BamParser::parse] error: "
+                "invalid record in file %s!\n", path_.c_str());
+            exit(1);
+        }
+
+        // CIGARs with more than 65535 operations are stored in a tag
+        if (cigar_length == 2 &&
+            readUint32(cigar_data) == packCigar(sequence_length, kCigarSoftClip) &&
+            cigarOperation(readUint32(cigar_data + 4)) == kCigarSkip) {
+            uint32_t long_cigar_length = 0;
+            const char* long_cigar = findLongCigar(tags, end, long_cigar_length);
+            if (long_cigar != nullptr &&
+                long_cigar + 4 * static_cast<uint64_t>(long_cigar_length) <= end) {
+                cigar_data = long_cigar;
+                cigar_length = long_cigar_length;
+            }
+        }
+
+        cigar.resize(cigar_length);
+        for (uint32_t i = 0; i < cigar_length; ++i) {
+            cigar[i] = readUint32(cigar_data + 4 * i);
+        }
+
+        bool is_mapped = reference_id >= 0 &&
+            static_cast<uint32_t>(reference_id) < references_.size();
+
+        std::unique_ptr<Overlap> overlap(new Overlap(name, name_length - 1,
+            is_mapped ? flag : flag | 0x4,
+            is_mapped ? references_[reference_id] : std::string(), position,
+            cigar.data(), cigar_length));
+
+        // bases are packed into 4 bits and qualities are stored without the
+        // offset of 33 (or as 0xFF if missing), only primary records keep them
+        if (keep_queries_ && is_mapped && !(flag & 0x904)) {
+            sequence.clear();
+            quality.clear();
+            static const char kBases[] = "=ACMGRSVTWYHKDBN";
+            sequence.resize(sequence_length);
+            for (uint32_t i = 0; i < sequence_length; ++i) {
+                uint32_t code = static_cast<unsigned char>(sequence_data[i >> 1]);
+                sequence[i] = kBases[i & 1 ? code & 0xF : code >> 4];
+            }
+            if (sequence_length > 0 &&
+                static_cast<unsigned char>(quality_data[0]) != 0xFF) {
+                quality.resize(sequence_length);
+                for (uint32_t i = 0; i < sequence_length; ++i) {
+                    quality[i] = quality_data[i] + '!';
+                }
+            }
+            overlap->store_query(flag, sequence.data(), sequence.size(),
+                quality.data(), quality.size());
+        }
+        dst.emplace_back(std::move(overlap));
+
+        data_begin_ += 4 + record_size;
+        parsed_bytes += record_size;
+    }
+
+    if (parsed_bytes < bytes && data_begin_ != data_.size()) {
+        fprintf(stderr, "[racon::BamParser::parse] error: "
+            "file %s is truncated!\n", path_.c_str());
+        exit(1);
+    }
+
+    return dst;
+}
+
+}
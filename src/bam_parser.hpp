@@ -0,0 +1,65 @@
+/*!
+ * @file bam_parser.hpp
+ *
+ * @brief BamParser class header file
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <memory>
+#include <vector>
+#include <string>
+
+#include "overlap_parser.hpp"
+
+namespace racon {
+
+class BamParser;
+std::unique_ptr<BamParser> createBamParser(const std::string& path,
+    bool keep_queries);
+
+/*!
+ * @brief Parses overlaps from BAM files, batches of BGZF blocks are
+ * decompressed in parallel and records are converted to overlaps without
+ * formatting them as text, bases and qualities of primary records are decoded
+ * and kept along with their overlaps only if keep_queries is set
+ */
+class BamParser: public OverlapParser {
+public:
+    ~BamParser();
+
+    void reset() override;
+
+    // bytes are counted in decompressed records
+    std::vector<std::unique_ptr<Overlap>> parse(uint64_t bytes,
+        const std::shared_ptr<thread_pool::ThreadPool>& thread_pool) override;
+
+    friend std::unique_ptr<BamParser> createBamParser(const std::string& path,
+        bool keep_queries);
+private:
+    BamParser(FILE* input, const std::string& path, bool keep_queries);
+    BamParser(const BamParser&) = delete;
+    const BamParser& operator=(const BamParser&) = delete;
+
+    // decompresses blocks until at least length bytes are buffered, returns
+    // false if the file ends before
+    bool fill(uint64_t length,
+        const std::shared_ptr<thread_pool::ThreadPool>& thread_pool);
+    void parse_header(const std::shared_ptr<thread_pool::ThreadPool>& thread_pool);
+
+    FILE* input_;
+    std::string path_;
+    bool keep_queries_;
+    bool is_eof_;
+
+    // decompressed data, bytes before data_begin_ are already parsed
+    std::vector<char> data_;
+    uint64_t data_begin_;
+
+    bool has_header_;
+    std::vector<std::string> references_;
+};
+
+}
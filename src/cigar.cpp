@@ -0,0 +1,132 @@
+/*!
+ * @file cigar.cpp
+ *
+ * @brief CIGAR source file
+ */
+
+#include "cigar.hpp"
+
+namespace racon {
+
+bool parseCigar(const char* src, uint32_t src_length, std::vector<uint32_t>& dst) {
+
+    dst.clear();
+
+    uint32_t length = 0;
+    bool has_length = false;
+    for (uint32_t i = 0; i < src_length; ++i) {
+        if (src[i] >= '0' && src[i] <= '9') {
+            length = length * 10 + (src[i] - '0');
+            has_length = true;
+            continue;
+        }
+
+        uint32_t operation;
+        switch (src[i]) {
+            case 'M': operation = kCigarMatch; break;
+            case 'I': operation = kCigarInsertion; break;
+            case 'D': operation = kCigarDeletion; break;
+            case 'N': operation = kCigarSkip; break;
+            case 'S': operation = kCigarSoftClip; break;
+            case 'H': operation = kCigarHardClip; break;
+            case 'P': operation = kCigarPadding; break;
+            case '=': operation = kCigarEqual; break;
+            case 'X': operation = kCigarMismatch; break;
+            default: return false;
+        }
+        if (!has_length) {
+            return false;
+        }
+
+        dst.emplace_back(packCigar(length, operation));
+        length = 0;
+        has_length = false;
+    }
+
+    return !has_length;
+}
+
+bool parseCs(const char* src, uint32_t src_length, std::vector<uint32_t>& dst) {
+
+    dst.clear();
+
+    auto append = [&dst] (uint32_t length, uint32_t operation) -> void {
+        if (!dst.empty() && cigarOperation(dst.back()) == operation) {
+            dst.back() += packCigar(length, 0);
+        } else {
+            dst.emplace_back(packCigar(length, operation));
+        }
+    };
+    auto skip_bases = [&] (uint32_t i) -> uint32_t {
+        while (i < src_length && ((src[i] >= 'A' && src[i] <= 'Z') ||
+            (src[i] >= 'a' && src[i] <= 'z'))) {
+            ++i;
+        }
+        return i;
+    };
+    auto parse_length = [&] (uint32_t& i, uint32_t& length) -> bool {
+        uint32_t begin = i;
+        for (length = 0; i < src_length && src[i] >= '0' && src[i] <= '9'; ++i) {
+            length = length * 10 + (src[i] - '0');
+        }
+        return i != begin && length != 0;
+    };
+
+    for (uint32_t i = 0; i < src_length; ) {
+        char type = src[i++];
+        uint32_t begin = i, length = 0;
+        switch (type) {
+            case ':': // identical bases
+                if (!parse_length(i, length)) {
+                    return false;
+                }
+                append(length, kCigarMatch);
+                break;
+            case '=': // identical bases (long form)
+            case '+':
+            case '-':
+                i = skip_bases(i);
+                if (i == begin) {
+                    return false;
+                }
+                append(i - begin, type == '+' ? kCigarInsertion :
+                    (type == '-' ? kCigarDeletion : kCigarMatch));
+                break;
+            case '*': // substitution of the target base with the query base
+                i = skip_bases(i);
+                if (i - begin != 2) {
+                    return false;
+                }
+                append(1, kCigarMatch);
+                break;
+            case '~': // intron given by its splice signals and length
+                i = skip_bases(i);
+                if (i - begin != 2 || !parse_length(i, length)) {
+                    return false;
+                }
+                begin = i;
+                i = skip_bases(i);
+                if (i - begin != 2) {
+                    return false;
+                }
+                append(length, kCigarSkip);
+                break;
+            default:
+                return false;
+        }
+    }
+
+    return true;
+}
+
+void alignmentToCigar(const unsigned char* alignment, uint32_t alignment_length,
+    std::vector<uint32_t>& dst) {
+
+    dst.clear();
+    forEachAlignmentRun(alignment, alignment_length,
+        [&dst] (uint32_t operation, uint32_t length) -> void {
+            dst.emplace_back(packCigar(length, operation));
+        });
+}
+
+}
@@ -0,0 +1,99 @@
+/*!
+ * @file cigar.hpp
+ *
+ * @brief CIGAR header file
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+namespace racon {
+
+/*!
+ * @brief CIGAR operations are packed into 32-bit words as in BAM, the length
+ * occupies the upper 28 bits and the operation (index in "MIDNSHP=X") the
+ * lowest 4 bits
+ */
+enum CigarOperation : uint32_t {
+    kCigarMatch = 0,
+    kCigarInsertion = 1,
+    kCigarDeletion = 2,
+    kCigarSkip = 3,
+    kCigarSoftClip = 4,
+    kCigarHardClip = 5,
+    kCigarPadding = 6,
+    kCigarEqual = 7,
+    kCigarMismatch = 8
+};
+
+inline uint32_t cigarOperation(uint32_t packed) {
+    return packed & 0xF;
+}
+
+inline uint32_t cigarLength(uint32_t packed) {
+    return packed >> 4;
+}
+
+inline uint32_t packCigar(uint32_t length, uint32_t operation) {
+    return length << 4 | operation;
+}
+
+inline char cigarOperationChar(uint32_t operation) {
+    return "MIDNSHP=X"[operation];
+}
+
+// M, I, S, = and X consume the query
+inline bool consumesQuery(uint32_t operation) {
+    return (0x193 >> operation) & 1;
+}
+
+// M, D, N, = and X consume the target
+inline bool consumesTarget(uint32_t operation) {
+    return (0x18D >> operation) & 1;
+}
+
+/*!
+ * @brief Parses a SAM CIGAR string into packed operations, returns false if
+ * the string is not a valid CIGAR
+ */
+bool parseCigar(const char* src, uint32_t src_length, std::vector<uint32_t>& dst);
+
+/*!
+ * @brief Parses a cs tag (short or long form as written by minimap2) into
+ * packed operations (mismatches are stored as M), returns false if the
+ * string is not a valid cs tag
+ */
+bool parseCs(const char* src, uint32_t src_length, std::vector<uint32_t>& dst);
+
+// edlib move codes are match, insertion, deletion and mismatch (stored as M)
+inline uint32_t alignmentMoveOperation(unsigned char move) {
+    return move == 1 ? kCigarInsertion : (move == 2 ? kCigarDeletion : kCigarMatch);
+}
+
+/*!
+ * @brief Calls f(operation, length) for each run of equal operations in an
+ * edlib alignment (move codes 0-3) without materializing a CIGAR
+ */
+template<class F>
+void forEachAlignmentRun(const unsigned char* alignment,
+    uint32_t alignment_length, F&& f) {
+
+    for (uint32_t i = 0; i < alignment_length; ) {
+        uint32_t operation = alignmentMoveOperation(alignment[i]), j = i + 1;
+        while (j < alignment_length && alignmentMoveOperation(alignment[j]) == operation) {
+            ++j;
+        }
+        f(operation, j - i);
+        i = j;
+    }
+}
+
+/*!
+ * @brief Converts an edlib alignment (move codes 0-3) into packed operations
+ */
+void alignmentToCigar(const unsigned char* alignment, uint32_t alignment_length,
+    std::vector<uint32_t>& dst);
+
+}
@@ -7,6 +7,7 @@
 #include <claraparabricks/genomeworks/utils/cudautils.hpp>
 
 #include "cudaaligner.hpp"
+#include "cigar.hpp"
 
 namespace racon {
 
@@ -50,11 +51,16 @@ CUDABatchAligner::~CUDABatchAligner()
 
 bool CUDABatchAligner::addOverlap(Overlap* overlap, std::vector<std::unique_ptr<Sequence>>& sequences)
 {
-    const char* q = !overlap->strand_ ? &(sequences[overlap->q_id_]->data()[overlap->q_begin_]) :
-        &(sequences[overlap->q_id_]->reverse_complement()[overlap->q_length_ - overlap->q_end_]);
     int32_t q_len = overlap->q_end_ - overlap->q_begin_;
-    const char* t = &(sequences[overlap->t_id_]->data()[overlap->t_begin_]);
+    q_.resize(q_len);
+    sequences[overlap->q_id_]->decode_data(overlap->strand_ ?
+        overlap->q_length_ - overlap->q_end_ : overlap->q_begin_, q_len,
+        overlap->strand_, &q_[0]);
+    const char* q = q_.data();
     int32_t t_len = overlap->t_end_ - overlap->t_begin_;
+    t_.resize(t_len);
+    sequences[overlap->t_id_]->decode_data(overlap->t_begin_, t_len, 0, &t_[0]);
+    const char* t = t_.data();
 
     // NOTE: The cudaaligner API for adding alignments is the opposite of edlib. Hence, what is
     // treated as target in edlib is query in cudaaligner and vice versa.
@@ -97,7 +103,8 @@ void CUDABatchAligner::generate_cigar_strings()
     }
     for(std::size_t a = 0; a < alignments.size(); a++)
     {
-        overlaps_[a]->cigar_ = alignments[a]->convert_to_cigar();
+        std::string cigar = alignments[a]->convert_to_cigar();
+        parseCigar(cigar.c_str(), cigar.size(), overlaps_[a]->cigar_);
     }
 }
 
@@ -81,6 +81,10 @@ class CUDABatchAligner
 
         std::vector<std::pair<std::string, std::string>> cpu_overlap_data_;
 
+        // Scratch buffers for decoded query and target sequences.
+        std::string q_;
+        std::string t_;
+
         // Static batch count used to generate batch IDs.
         static std::atomic<uint32_t> batches;
 
@@ -9,6 +9,7 @@
 #include <cstring>
 #include <algorithm>
 
+#include "sequence.hpp"
 #include "cudabatch.hpp"
 #include "cudautils.hpp"
 
@@ -74,15 +75,20 @@ CUDABatchProcessor::~CUDABatchProcessor()
     GW_CU_CHECK_ERR(cudaStreamDestroy(stream_));
 }
 
-bool CUDABatchProcessor::addWindow(std::shared_ptr<Window> window)
+bool CUDABatchProcessor::addWindow(Window* window)
 {
     Group poa_group;
-    uint32_t num_seqs = window->sequences_.size();
+    uint32_t num_seqs = window->num_layers_;
     std::vector<std::vector<int8_t>> all_read_weights(num_seqs, std::vector<int8_t>());
 
+    // Decode window layers (cudapoa copies them when the group is added).
+    std::string data, quality;
+    std::vector<std::pair<const char*, uint32_t>> sequences, all_qualities;
+    window->decode_layers(data, quality, sequences, all_qualities);
+
     // Add first sequence as backbone to graph.
-    std::pair<const char*, uint32_t> seq = window->sequences_.front();
-    std::pair<const char*, uint32_t> qualities = window->qualities_.front();
+    std::pair<const char*, uint32_t> seq = sequences.front();
+    std::pair<const char*, uint32_t> qualities = all_qualities.front();
     std::vector<int8_t> backbone_weights;
     convertPhredQualityToWeights(qualities.first, qualities.second, all_read_weights[0]);
     Entry e = {
@@ -94,14 +100,14 @@ bool CUDABatchProcessor::addWindow(std::shared_ptr<Window> window)
 
     // Add the rest of the sequences in sorted order of starting positions.
     std::vector<uint32_t> rank;
-    rank.reserve(window->sequences_.size());
+    rank.reserve(num_seqs);
 
     for (uint32_t i = 0; i < num_seqs; ++i) {
         rank.emplace_back(i);
     }
 
     std::sort(rank.begin() + 1, rank.end(), [&](uint32_t lhs, uint32_t rhs) {
-            return window->positions_[lhs].first < window->positions_[rhs].first; });
+            return window->layers_[lhs].begin < window->layers_[rhs].begin; });
 
     // Start from index 1 since first sequence has already been added as backbone.
     uint32_t long_seq = 0;
@@ -109,8 +115,8 @@ bool CUDABatchProcessor::addWindow(std::shared_ptr<Window> window)
     for(uint32_t j = 1; j < num_seqs; j++)
     {
         uint32_t i = rank.at(j);
-        seq = window->sequences_.at(i);
-        qualities = window->qualities_.at(i);
+        seq = sequences.at(i);
+        qualities = all_qualities.at(i);
         convertPhredQualityToWeights(qualities.first, qualities.second, all_read_weights[i]);
 
         Entry p = {
@@ -216,10 +222,12 @@ void CUDABatchProcessor::getConsensus()
             // This is a special case borrowed from the CPU version.
             // TODO: We still run this case through the GPU, but could take it out.
             bool consensus_status = false;
-            if (window->sequences_.size() < 3)
+            if (window->num_layers_ < 3)
             {
-                window->consensus_ = std::string(window->sequences_.front().first,
-                        window->sequences_.front().second);
+                const auto& backbone = window->layers_[0];
+                window->consensus_.resize(backbone.sequence_length);
+                backbone.sequence->decode_data(backbone.sequence_begin,
+                        backbone.sequence_length, 0, &window->consensus_[0]);
 
                 // This status is borrowed from the CPU version which considers this
                 // a failed consensus. All other cases are true.
@@ -36,7 +36,7 @@ public:
      *
      * @return True of window could be added to the batch.
      */
-    bool addWindow(std::shared_ptr<Window> window);
+    bool addWindow(Window* window);
 
     /**
      * @brief Checks if batch has any windows to process.
@@ -111,7 +111,7 @@ protected:
     // Stream for running POA batch.
     cudaStream_t stream_;
     // Windows belonging to the batch.
-    std::vector<std::shared_ptr<Window>> windows_;
+    std::vector<Window*> windows_;
 
     // Consensus generation status for each window.
     std::vector<bool> window_consensus_status_;
@@ -10,6 +10,8 @@
 #include <cuda_profiler_api.h>
 
 #include "sequence.hpp"
+#include "overlap_cache.hpp"
+#include "overlap_parser.hpp"
 #include "logger.hpp"
 #include "cudapolisher.hpp"
 #include <claraparabricks/genomeworks/utils/cudautils.hpp>
@@ -26,14 +28,22 @@ const uint32_t RACON_LOGGER_BIN_SIZE = 20;
 
 CUDAPolisher::CUDAPolisher(std::unique_ptr<bioparser::Parser<Sequence>> sparser,
     std::unique_ptr<bioparser::Parser<Overlap>> oparser,
+    std::unique_ptr<OverlapParser> nparser,
     std::unique_ptr<bioparser::Parser<Sequence>> tparser,
     PolisherType type, uint32_t window_length, double quality_threshold,
     double error_threshold, bool trim, int8_t match, int8_t mismatch, int8_t gap,
-    uint32_t num_threads, uint32_t cudapoa_batches, bool cuda_banded_alignment,
-    uint32_t cudaaligner_batches, uint32_t cudaaligner_band_width)
-        : Polisher(std::move(sparser), std::move(oparser), std::move(tparser),
-                type, window_length, quality_threshold, error_threshold, trim,
-                match, mismatch, gap, num_threads)
+    uint32_t num_threads, uint64_t split_size, bool lazy_loading,
+    uint32_t shard, uint32_t num_shards, bool target_sorted,
+    int32_t max_depth, uint32_t poa_band_width, double agreement_threshold,
+    std::unique_ptr<OverlapCache> cache,
+    uint32_t cudapoa_batches,
+    bool cuda_banded_alignment, uint32_t cudaaligner_batches,
+    uint32_t cudaaligner_band_width)
+        : Polisher(std::move(sparser), std::move(oparser), std::move(nparser),
+                std::move(tparser), type, window_length, quality_threshold,
+                error_threshold, trim, match, mismatch, gap, num_threads,
+                split_size, lazy_loading, shard, num_shards, target_sorted,
+                max_depth, poa_band_width, agreement_threshold, std::move(cache))
         , cudapoa_batches_(cudapoa_batches)
         , cudaaligner_batches_(cudaaligner_batches)
         , gap_(gap)
@@ -73,6 +83,12 @@ CUDAPolisher::~CUDAPolisher()
 
 void CUDAPolisher::find_overlap_breaking_points(std::vector<std::unique_ptr<Overlap>>& overlaps)
 {
+    // nothing to batch (and no mean length to derive the band width from)
+    if (overlaps.empty())
+    {
+        return;
+    }
+
     if (cudaaligner_batches_ >= 1)
     {
         logger_->log();
@@ -213,12 +229,12 @@ void CUDAPolisher::find_overlap_breaking_points(std::vector<std::unique_ptr<Over
     Polisher::find_overlap_breaking_points(overlaps);
 }
 
-void CUDAPolisher::polish(std::vector<std::unique_ptr<Sequence>>& dst,
+void CUDAPolisher::polish_windows(const SequenceSink& sink,
     bool drop_unpolished_sequences)
 {
     if (cudapoa_batches_ < 1)
     {
-        Polisher::polish(dst, drop_unpolished_sequences);
+        Polisher::polish_windows(sink, drop_unpolished_sequences);
     }
     else
     {
@@ -245,7 +261,7 @@ void CUDAPolisher::polish(std::vector<std::unique_ptr<Sequence>>& dst,
         std::mutex mutex_windows;
 
         // Initialize window consensus statuses.
-        window_consensus_status_.resize(windows_.size(), false);
+        window_consensus_status_.assign(windows_.size(), false);
 
         // Index of next window to be added to a batch.
         uint32_t next_window_index = 0;
@@ -262,7 +278,7 @@ void CUDAPolisher::polish(std::vector<std::unique_ptr<Sequence>>& dst,
             uint32_t count = windows_.size();
             while(next_window_index < count)
             {
-                if (batch->addWindow(windows_.at(next_window_index)))
+                if (batch->addWindow(&windows_.at(next_window_index)))
                 {
                     next_window_index++;
                 }
@@ -361,8 +377,9 @@ void CUDAPolisher::polish(std::vector<std::unique_ptr<Sequence>>& dst,
                 thread_failed_windows.emplace_back(thread_pool_->Submit(
                             [&](uint64_t j) -> bool {
                             auto it = thread_pool_->thread_map().find(std::this_thread::get_id());
-                            return window_consensus_status_.at(j) = windows_[j]->generate_consensus(
-                                    alignment_engines_[it->second], trim_);
+                            return window_consensus_status_.at(j) = windows_[j].generate_consensus(
+                                    alignment_engines_[it->second],
+                                    consensus_contexts_[it->second], trim_);
                             }, i));
             }
         }
@@ -384,31 +401,33 @@ void CUDAPolisher::polish(std::vector<std::unique_ptr<Sequence>>& dst,
         for (uint64_t i = 0; i < windows_.size(); ++i) {
 
             num_polished_windows += window_consensus_status_.at(i) == true ? 1 : 0;
-            polished_data += windows_[i]->consensus();
+            polished_data += windows_[i].consensus();
 
-            if (i == windows_.size() - 1 || windows_[i + 1]->rank() == 0) {
+            if (i == windows_.size() - 1 || windows_[i + 1].rank() == 0) {
                 double polished_ratio = num_polished_windows /
-                    static_cast<double>(windows_[i]->rank() + 1);
+                    static_cast<double>(windows_[i].rank() + 1);
 
                 if (!drop_unpolished_sequences || polished_ratio > 0) {
                     std::string tags = type_ == PolisherType::kF ? "r" : "";
                     tags += " LN:i:" + std::to_string(polished_data.size());
-                    tags += " RC:i:" + std::to_string(targets_coverages_[windows_[i]->id()]);
+                    tags += " RC:i:" + std::to_string(targets_coverages_[windows_[i].id()]);
                     tags += " XC:f:" + std::to_string(polished_ratio);
-                    dst.emplace_back(createSequence(sequences_[windows_[i]->id()]->name() +
+                    sink(createSequence(sequences_[windows_[i].id()]->name() +
                                 tags, polished_data));
                 }
 
                 num_polished_windows = 0;
                 polished_data.clear();
             }
-            windows_[i].reset();
+            windows_[i].clear_consensus();
         }
 
         logger_->log("[racon::CUDAPolisher::polish] generated consensus");
 
-        // Clear POA processors.
+        // Clear POA processors and windows of the current split.
         batch_processors_.clear();
+        std::vector<Window>().swap(windows_);
+        std::vector<Layer>().swap(layers_);
     }
 }
 
@@ -20,28 +20,37 @@ class CUDAPolisher : public Polisher {
 public:
     ~CUDAPolisher();
 
-    virtual void polish(std::vector<std::unique_ptr<Sequence>>& dst,
-        bool drop_unpolished_sequences) override;
-
     friend std::unique_ptr<Polisher> createPolisher(const std::string& sequences_path,
         const std::string& overlaps_path, const std::string& target_path,
         PolisherType type, uint32_t window_length, double quality_threshold,
         double error_threshold, bool trim, int8_t match, int8_t mismatch, int8_t gap,
         uint32_t num_threads, uint32_t cudapoa_batches, bool cuda_banded_alignment,
-        uint32_t cudaaligner_batches, uint32_t cudaaligner_band_width);
+        uint32_t cudaaligner_batches, uint32_t cudaaligner_band_width,
+        uint64_t split_size, const std::string& cache_path, bool lazy_loading,
+        uint32_t shard, uint32_t num_shards, bool target_sorted,
+        int32_t max_depth, uint32_t poa_band_width, double agreement_threshold);
 
 protected:
     CUDAPolisher(std::unique_ptr<bioparser::Parser<Sequence>> sparser,
         std::unique_ptr<bioparser::Parser<Overlap>> oparser,
+        std::unique_ptr<OverlapParser> nparser,
         std::unique_ptr<bioparser::Parser<Sequence>> tparser,
         PolisherType type, uint32_t window_length, double quality_threshold,
         double error_threshold, bool trim, int8_t match, int8_t mismatch, int8_t gap,
-        uint32_t num_threads, uint32_t cudapoa_batches, bool cuda_banded_alignment,
-        uint32_t cudaaligner_batches, uint32_t cudaaligner_band_width);
+        uint32_t num_threads, uint64_t split_size, bool lazy_loading,
+        uint32_t shard, uint32_t num_shards, bool target_sorted,
+        int32_t max_depth, uint32_t poa_band_width, double agreement_threshold,
+        std::unique_ptr<OverlapCache> cache,
+        uint32_t cudapoa_batches,
+        bool cuda_banded_alignment, uint32_t cudaaligner_batches,
+        uint32_t cudaaligner_band_width);
     CUDAPolisher(const CUDAPolisher&) = delete;
     const CUDAPolisher& operator=(const CUDAPolisher&) = delete;
     virtual void find_overlap_breaking_points(std::vector<std::unique_ptr<Overlap>>& overlaps) override;
 
+    virtual void polish_windows(const SequenceSink& sink,
+        bool drop_unpolished_sequences) override;
+
     static std::vector<uint32_t> calculate_batches_per_gpu(uint32_t cudapoa_batches, uint32_t gpus);
 
     // Vector of POA batches.
@@ -7,6 +7,7 @@
 #include <vector>
 
 #include "sequence.hpp"
+#include "sequence_writer.hpp"
 #include "polisher.hpp"
 #ifdef CUDA_ENABLED
 #include "cuda/cudapolisher.hpp"
@@ -14,6 +15,16 @@
 
 static const int32_t CUDAALIGNER_INPUT_CODE = 10000;
 static const int32_t CUDAALIGNER_BAND_WIDTH_INPUT_CODE = 10001;
+static const int32_t SPLIT_INPUT_CODE = 10002;
+static const int32_t CACHE_INPUT_CODE = 10003;
+static const int32_t LAZY_LOADING_INPUT_CODE = 10004;
+static const int32_t OUTPUT_INPUT_CODE = 10005;
+static const int32_t LINE_WIDTH_INPUT_CODE = 10006;
+static const int32_t SHARD_INPUT_CODE = 10007;
+static const int32_t TARGET_SORTED_INPUT_CODE = 10008;
+static const int32_t MAX_DEPTH_INPUT_CODE = 10009;
+static const int32_t POA_BAND_WIDTH_INPUT_CODE = 10010;
+static const int32_t AGREEMENT_THRESHOLD_INPUT_CODE = 10011;
 
 static struct option options[] = {
     {"include-unpolished", no_argument, 0, 'u'},
@@ -26,6 +37,16 @@ static struct option options[] = {
     {"mismatch", required_argument, 0, 'x'},
     {"gap", required_argument, 0, 'g'},
     {"threads", required_argument, 0, 't'},
+    {"split", required_argument, 0, SPLIT_INPUT_CODE},
+    {"cache", required_argument, 0, CACHE_INPUT_CODE},
+    {"lazy-loading", no_argument, 0, LAZY_LOADING_INPUT_CODE},
+    {"output", required_argument, 0, OUTPUT_INPUT_CODE},
+    {"line-width", required_argument, 0, LINE_WIDTH_INPUT_CODE},
+    {"shard", required_argument, 0, SHARD_INPUT_CODE},
+    {"target-sorted", no_argument, 0, TARGET_SORTED_INPUT_CODE},
+    {"max-depth", required_argument, 0, MAX_DEPTH_INPUT_CODE},
+    {"poa-band-width", required_argument, 0, POA_BAND_WIDTH_INPUT_CODE},
+    {"agreement-threshold", required_argument, 0, AGREEMENT_THRESHOLD_INPUT_CODE},
     {"version", no_argument, 0, 'v'},
     {"help", no_argument, 0, 'h'},
 #ifdef CUDA_ENABLED
@@ -55,6 +76,16 @@ int main(int argc, char** argv) {
 
     bool drop_unpolished_sequences = true;
     uint32_t num_threads = 1;
+    uint64_t split_size = 0;
+    std::string cache_path = "";
+    bool lazy_loading = false;
+    std::string output_path = "";
+    uint32_t line_width = 0;
+    uint32_t shard = 1, num_shards = 1;
+    bool target_sorted = false;
+    int32_t max_depth = 0;
+    uint32_t poa_band_width = 0;
+    double agreement_threshold = 0;
 
     uint32_t cudapoa_batches = 0;
     uint32_t cudaaligner_batches = 0;
@@ -99,6 +130,40 @@ int main(int argc, char** argv) {
             case 't':
                 num_threads = atoi(optarg);
                 break;
+            case SPLIT_INPUT_CODE:
+                split_size = strtoull(optarg, nullptr, 10);
+                break;
+            case CACHE_INPUT_CODE:
+                cache_path = optarg;
+                break;
+            case LAZY_LOADING_INPUT_CODE:
+                lazy_loading = true;
+                break;
+            case OUTPUT_INPUT_CODE:
+                output_path = optarg;
+                break;
+            case LINE_WIDTH_INPUT_CODE:
+                line_width = atoi(optarg);
+                break;
+            case SHARD_INPUT_CODE:
+                if (sscanf(optarg, "%u/%u", &shard, &num_shards) != 2 ||
+                    shard == 0 || shard > num_shards) {
+                    fprintf(stderr, "[racon::] error: invalid shard %s!\n", optarg);
+                    exit(1);
+                }
+                break;
+            case TARGET_SORTED_INPUT_CODE:
+                target_sorted = true;
+                break;
+            case MAX_DEPTH_INPUT_CODE:
+                max_depth = atoi(optarg);
+                break;
+            case POA_BAND_WIDTH_INPUT_CODE:
+                poa_band_width = atoi(optarg);
+                break;
+            case AGREEMENT_THRESHOLD_INPUT_CODE:
+                agreement_threshold = atof(optarg);
+                break;
             case 'v':
                 printf("%s\n", VERSION);
                 exit(0);
@@ -138,42 +203,52 @@ int main(int argc, char** argv) {
         input_paths.emplace_back(argv[i]);
     }
 
-    if (input_paths.size() < 3) {
+    if (input_paths.size() < 2) {
         fprintf(stderr, "[racon::] error: missing input file(s)!\n");
         help();
         exit(1);
     }
+    // sequences are optional for overlaps in SAM/BAM format
+    if (input_paths.size() == 2) {
+        input_paths.emplace(input_paths.begin(), std::string());
+    }
 
     auto polisher = racon::createPolisher(input_paths[0], input_paths[1],
         input_paths[2], type == 0 ? racon::PolisherType::kC :
         racon::PolisherType::kF, window_length, quality_threshold,
         error_threshold, trim, match, mismatch, gap, num_threads,
         cudapoa_batches, cuda_banded_alignment, cudaaligner_batches,
-        cudaaligner_band_width);
+        cudaaligner_band_width, split_size, cache_path, lazy_loading,
+        shard - 1, num_shards, target_sorted, max_depth, poa_band_width,
+        agreement_threshold);
+
+    auto writer = racon::createSequenceWriter(output_path, line_width);
 
     polisher->initialize();
 
-    std::vector<std::unique_ptr<racon::Sequence>> polished_sequences;
-    polisher->polish(polished_sequences, drop_unpolished_sequences);
+    polisher->polish([&writer] (std::unique_ptr<racon::Sequence> sequence) -> void {
+        writer->write(std::move(sequence));
+    }, drop_unpolished_sequences);
 
-    for (const auto& it: polished_sequences) {
-        fprintf(stdout, ">%s\n%s\n", it->name().c_str(), it->data().c_str());
-    }
+    writer->close();
 
     return 0;
 }
 
 void help() {
     printf(
-        "usage: racon [options ...] <sequences> <overlaps> <target sequences>\n"
+        "usage: racon [options ...] [<sequences>] <overlaps> <target sequences>\n"
         "\n"
         "    #default output is stdout\n"
         "    <sequences>\n"
         "        input file in FASTA/FASTQ format (can be compressed with gzip)\n"
-        "        containing sequences used for correction\n"
+        "        containing sequences used for correction, can be omitted if\n"
+        "        overlaps are in SAM/BAM format in which case sequences are\n"
+        "        taken from primary alignments\n"
         "    <overlaps>\n"
         "        input file in MHAP/PAF/SAM format (can be compressed with gzip)\n"
-        "        containing overlaps between sequences and target sequences\n"
+        "        or BAM format containing overlaps between sequences and target\n"
+        "        sequences\n"
         "    <target sequences>\n"
         "        input file in FASTA/FASTQ format (can be compressed with gzip)\n"
         "        containing sequences which will be corrected\n"
@@ -207,6 +282,62 @@ void help() {
         "        -t, --threads <int>\n"
         "            default: 1\n"
         "            number of threads\n"
+        "        --split <int>\n"
+        "            split target sequences into chunks of desired size in bytes\n"
+        "            which are polished one after another (sequences and overlaps\n"
+        "            files are not split, sequences are loaded only once)\n"
+        "        --cache <file>\n"
+        "            stores breaking points of overlaps into file or loads them if\n"
+        "            file exists and was created from the same input files with\n"
+        "            equal window length, error threshold and polishing type\n"
+        "            (useful when rerunning with different POA parameters or\n"
+        "            --max-depth)\n"
+        "        --lazy-loading\n"
+        "            parses overlaps before sequences and loads only sequences\n"
+        "            which overlap targets (reduces memory when polishing a\n"
+        "            subset of targets, overlaps are parsed one extra time)\n"
+        "        --output <file>\n"
+        "            default: stdout\n"
+        "            output file, compressed with BGZF (gzip compatible) if it\n"
+        "            ends with .gz, sequences are written as soon as polished\n"
+        "        --line-width <int>\n"
+        "            default: 0\n"
+        "            wraps output sequences to lines of given length (0 disables\n"
+        "            wrapping)\n"
+        "        --shard <int>/<int>\n"
+        "            polishes only the i-th out of N shards (1 <= i <= N) of\n"
+        "            target sequences, shards are contiguous and balanced by\n"
+        "            target length times coverage so that outputs of all shards\n"
+        "            concatenated in order equal the unsharded output, overlaps\n"
+        "            are parsed one extra time (shared with --lazy-loading) and\n"
+        "            only reads of the shard are loaded\n"
+        "        --target-sorted\n"
+        "            overlaps are grouped by target (e.g. coordinate sorted BAM\n"
+        "            or PAF sorted by target name), each target is polished as\n"
+        "            soon as all of its overlaps are parsed so that only a few\n"
+        "            targets are resident and is written in the order of the\n"
+        "            groups (targets without overlaps last), --split is ignored\n"
+        "            and contig polishing parses overlaps one extra time to find\n"
+        "            the best overlap of each read\n"
+        "        --max-depth <int>\n"
+        "            default: 0\n"
+        "            maximum number of layers per window, layers are ranked by\n"
+        "            overlap identity, window span and base quality (0 disables\n"
+        "            the limit, -1 sets it to twice the median target coverage\n"
+        "            but at least 60, with --target-sorted fragment correction\n"
+        "            then parses overlaps one extra time)\n"
+        "        --poa-band-width <int>\n"
+        "            default: 0\n"
+        "            aligns layers to the POA graph only within given distance\n"
+        "            of their expected diagonal, the band is doubled whenever\n"
+        "            the alignment reaches its edge (0 disables banding)\n"
+        "        --agreement-threshold <float>\n"
+        "            default: 0\n"
+        "            windows in which at least given fraction of layers agrees\n"
+        "            with the backbone (spans the whole window and shares most of\n"
+        "            its k-mers with it) are left unchanged without building the\n"
+        "            POA graph, unless some base of the backbone is not supported\n"
+        "            by most of the spanning layers (0 disables the check)\n"
         "        --version\n"
         "            prints the version number\n"
         "        -h, --help\n"
@@ -0,0 +1,147 @@
+/*!
+ * @file name_index.cpp
+ *
+ * @brief NameIndex class source file
+ */
+
+#include <string.h>
+
+#include "name_index.hpp"
+
+namespace racon {
+
+constexpr uint64_t kInitialCapacity = 1024;
+
+uint64_t hashName(const char* name, uint32_t name_length) {
+
+    uint64_t hash = 0x9E3779B97F4A7C15ULL ^ name_length;
+    uint32_t i = 0;
+    for (; i + 8 <= name_length; i += 8) {
+        uint64_t word;
+        memcpy(&word, name + i, 8);
+        hash = (hash ^ word) * 0xBF58476D1CE4E5B9ULL;
+        hash ^= hash >> 31;
+    }
+    uint64_t word = 0;
+    memcpy(&word, name + i, name_length - i);
+    hash = (hash ^ word) * 0x94D049BB133111EBULL;
+    hash ^= hash >> 29;
+    hash *= 0xBF58476D1CE4E5B9ULL;
+    return hash ^ (hash >> 32);
+}
+
+NameIndex::NameIndex()
+        : names_(), values_(), arena_(), size_(0) {
+}
+
+bool NameIndex::is_equal(uint64_t name_offset, const char* name,
+    uint32_t name_length) const {
+
+    uint32_t length;
+    memcpy(&length, &arena_[name_offset], sizeof(length));
+    return length == name_length &&
+        memcmp(&arena_[name_offset + sizeof(length)], name, name_length) == 0;
+}
+
+uint64_t NameIndex::probe(const char* name, uint32_t name_length,
+    uint64_t hash, uint64_t value_role, uint64_t& name_offset) const {
+
+    // both roles of a name share the hash, i.e. they lie in the same chain
+    uint64_t mask = names_.size() - 1;
+    for (uint64_t i = hash & mask; ; i = (i + 1) & mask) {
+        if (names_[i] == 0) {
+            return i;
+        }
+        if (name_offset != names_[i] - 1 &&
+            !is_equal(names_[i] - 1, name, name_length)) {
+            continue;
+        }
+        name_offset = names_[i] - 1;
+        if ((values_[i] & 1) == value_role) {
+            return i;
+        }
+    }
+}
+
+void NameIndex::insert(const char* name, uint32_t name_length, NameRole role,
+    uint64_t id) {
+    insert(name, name_length, hashName(name, name_length), role, id);
+}
+
+void NameIndex::insert(const char* name, uint32_t name_length, uint64_t hash,
+    NameRole role, uint64_t id) {
+
+    if (2 * (size_ + 1) > names_.size()) {
+        rehash(names_.empty() ? kInitialCapacity : 2 * names_.size());
+    }
+
+    uint64_t value_role = role == NameRole::kTarget ? 1 : 0;
+    uint64_t name_offset = -1;
+    uint64_t i = probe(name, name_length, hash, value_role, name_offset);
+
+    if (names_[i] == 0) {
+        if (name_offset == static_cast<uint64_t>(-1)) {
+            name_offset = arena_.size();
+            arena_.resize(arena_.size() + sizeof(name_length) + name_length);
+            memcpy(&arena_[name_offset], &name_length, sizeof(name_length));
+            memcpy(&arena_[name_offset + sizeof(name_length)], name, name_length);
+        }
+        names_[i] = name_offset + 1;
+        ++size_;
+    }
+    values_[i] = id << 1 | value_role;
+}
+
+bool NameIndex::find(const char* name, uint32_t name_length, NameRole role,
+    uint64_t& id) const {
+    return find(name, name_length, hashName(name, name_length), role, id);
+}
+
+bool NameIndex::find(const char* name, uint32_t name_length, uint64_t hash,
+    NameRole role, uint64_t& id) const {
+
+    if (size_ == 0) {
+        return false;
+    }
+
+    uint64_t name_offset = -1;
+    uint64_t i = probe(name, name_length, hash,
+        role == NameRole::kTarget ? 1 : 0, name_offset);
+    if (names_[i] == 0) {
+        return false;
+    }
+    id = values_[i] >> 1;
+    return true;
+}
+
+void NameIndex::rehash(uint64_t capacity) {
+
+    std::vector<uint64_t> names(capacity, 0), values(capacity, 0);
+
+    uint64_t mask = capacity - 1;
+    for (uint64_t i = 0; i < names_.size(); ++i) {
+        if (names_[i] == 0) {
+            continue;
+        }
+        uint32_t length;
+        memcpy(&length, &arena_[names_[i] - 1], sizeof(length));
+        uint64_t j = hashName(&arena_[names_[i] - 1 + sizeof(length)], length) & mask;
+        while (names[j] != 0) {
+            j = (j + 1) & mask;
+        }
+        names[j] = names_[i];
+        values[j] = values_[i];
+    }
+
+    names_.swap(names);
+    values_.swap(values);
+}
+
+void NameIndex::clear() {
+    std::vector<uint64_t>().swap(names_);
+    std::vector<uint64_t>().swap(values_);
+    std::vector<char>().swap(arena_);
+    size_ = 0;
+}
+
+}
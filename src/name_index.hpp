@@ -0,0 +1,86 @@
+/*!
+ * @file name_index.hpp
+ *
+ * @brief NameIndex class header file
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+namespace racon {
+
+enum class NameRole {
+    kQuery, // sequence used for correction
+    kTarget // sequence which is corrected
+};
+
+/*!
+ * @brief Hash of a sequence name as used by NameIndex
+ */
+uint64_t hashName(const char* name, uint32_t name_length);
+
+/*!
+ * @brief Open addressing hash table mapping sequence names to ids, names are
+ * copied into a single arena and the role is kept as the lowest bit of the
+ * stored value so that a name can map to both a query and a target id
+ */
+class NameIndex {
+public:
+    NameIndex();
+    ~NameIndex() = default;
+
+    NameIndex(const NameIndex&) = delete;
+    const NameIndex& operator=(const NameIndex&) = delete;
+
+    uint64_t size() const {
+        return size_;
+    }
+
+    /*!
+     * @brief Maps name with given role to id, overwrites the previous id
+     */
+    void insert(const char* name, uint32_t name_length, NameRole role,
+        uint64_t id);
+
+    /*!
+     * @brief Same as above with hash precomputed by hashName (e.g. in
+     * parallel before names are inserted serially)
+     */
+    void insert(const char* name, uint32_t name_length, uint64_t hash,
+        NameRole role, uint64_t id);
+
+    /*!
+     * @brief Returns false if name with given role is not in the index
+     */
+    bool find(const char* name, uint32_t name_length, NameRole role,
+        uint64_t& id) const;
+    bool find(const char* name, uint32_t name_length, uint64_t hash,
+        NameRole role, uint64_t& id) const;
+
+    /*!
+     * @brief Removes all names and frees memory
+     */
+    void clear();
+
+private:
+    // returns the slot containing name with given role or the first empty
+    // one, name_offset is set to the arena offset of name if it is already
+    // stored under any role
+    uint64_t probe(const char* name, uint32_t name_length, uint64_t hash,
+        uint64_t value_role, uint64_t& name_offset) const;
+    bool is_equal(uint64_t name_offset, const char* name,
+        uint32_t name_length) const;
+    void rehash(uint64_t capacity);
+
+    // arena offset + 1 of the name (0 marks an empty slot)
+    std::vector<uint64_t> names_;
+    // id << 1 | role
+    std::vector<uint64_t> values_;
+    // each name is stored as its 4 byte length followed by its characters
+    std::vector<char> arena_;
+    uint64_t size_;
+};
+
+}
@@ -4,14 +4,208 @@
  * @brief Overlap class source file
  */
 
+#include <math.h>
 #include <algorithm>
 
 #include "sequence.hpp"
+#include "name_index.hpp"
+#include "cigar.hpp"
 #include "overlap.hpp"
 #include "edlib.h"
 
 namespace racon {
 
+// bound of the edit distance relative to the first one
+constexpr uint32_t kMaxDistanceFactor = 2;
+// overlaps at least this long are aligned piecewise between exact k-mer
+// anchors which are at least kAnchorSpacing bases apart
+constexpr uint32_t kAnchoredAlignmentLength = 20000;
+constexpr uint32_t kAnchorLength = 15;
+constexpr uint32_t kAnchorSpacing = 2000;
+
+// returns colinear exact matches of k-mers which are unique in the target as
+// pairs of query and target positions, the diagonal of each anchor differs
+// from that of the previous one (or of the start and end of the alignment)
+// by at most max_drift per query base
+std::vector<std::pair<uint32_t, uint32_t>> findAnchors(const char* q,
+    uint32_t q_length, const char* t, uint32_t t_length, double max_drift) {
+
+    auto find_kmers = [] (const char* src, uint32_t src_length,
+        std::vector<std::pair<uint64_t, uint32_t>>& dst) -> void {
+
+        const uint64_t mask = (1ULL << (2 * kAnchorLength)) - 1;
+        uint64_t kmer = 0;
+        for (uint32_t i = 0, valid_length = 0; i < src_length; ++i) {
+            uint64_t c;
+            switch (src[i]) {
+                case 'A': c = 0; break;
+                case 'C': c = 1; break;
+                case 'G': c = 2; break;
+                case 'T': c = 3; break;
+                default: valid_length = 0; continue;
+            }
+            kmer = ((kmer << 2) | c) & mask;
+            if (++valid_length >= kAnchorLength) {
+                dst.emplace_back(kmer, i + 1 - kAnchorLength);
+            }
+        }
+    };
+
+    std::vector<std::pair<uint64_t, uint32_t>> t_kmers, q_kmers;
+    find_kmers(t, t_length, t_kmers);
+    find_kmers(q, q_length, q_kmers);
+
+    std::sort(t_kmers.begin(), t_kmers.end());
+    uint64_t n = 0;
+    for (uint64_t i = 0, j = 0; i < t_kmers.size(); i = j) {
+        j = i + 1;
+        while (j < t_kmers.size() && t_kmers[j].first == t_kmers[i].first) {
+            ++j;
+        }
+        if (j == i + 1) {
+            t_kmers[n++] = t_kmers[i];
+        }
+    }
+    t_kmers.resize(n);
+
+    // matches are sorted by query position
+    std::vector<std::pair<uint32_t, uint32_t>> matches;
+    for (const auto& it: q_kmers) {
+        auto match = std::lower_bound(t_kmers.begin(), t_kmers.end(),
+            std::make_pair(it.first, 0U));
+        if (match != t_kmers.end() && match->first == it.first) {
+            matches.emplace_back(it.second, match->second);
+        }
+    }
+
+    // longest chain increasing in target positions
+    std::vector<uint64_t> tails, predecessors(matches.size(), -1);
+    for (uint64_t i = 0; i < matches.size(); ++i) {
+        auto it = std::lower_bound(tails.begin(), tails.end(), i,
+            [&] (uint64_t lhs, uint64_t rhs) -> bool {
+                return matches[lhs].second < matches[rhs].second;
+            });
+        if (it != tails.begin()) {
+            predecessors[i] = *(it - 1);
+        }
+        if (it == tails.end()) {
+            tails.emplace_back(i);
+        } else {
+            *it = i;
+        }
+    }
+
+    std::vector<std::pair<uint32_t, uint32_t>> chain;
+    for (uint64_t i = tails.empty() ? -1 : tails.back(); i != static_cast<uint64_t>(-1);
+        i = predecessors[i]) {
+        chain.emplace_back(matches[i]);
+    }
+    std::reverse(chain.begin(), chain.end());
+
+    // a spurious match would force a long indel into the segments around it
+    auto is_near = [&] (const std::pair<uint32_t, uint32_t>& lhs,
+        const std::pair<uint32_t, uint32_t>& rhs) -> bool {
+        int64_t drift = (static_cast<int64_t>(rhs.second) - lhs.second) -
+            (static_cast<int64_t>(rhs.first) - lhs.first);
+        double max_distance = max_drift * (rhs.first - lhs.first);
+        return drift <= max_distance && -drift <= max_distance;
+    };
+
+    std::vector<std::pair<uint32_t, uint32_t>> anchors;
+    std::pair<uint32_t, uint32_t> previous(0, 0);
+    for (const auto& it: chain) {
+        if (it.first >= previous.first + kAnchorSpacing &&
+            (anchors.empty() || it.second >= previous.second + kAnchorLength) &&
+            is_near(previous, it)) {
+            anchors.emplace_back(it);
+            previous = it;
+        }
+    }
+    while (!anchors.empty() && !is_near(anchors.back(),
+        std::make_pair(q_length, t_length))) {
+        anchors.pop_back();
+    }
+    return anchors;
+}
+
+// collects breaking points (first and last match of each window) from runs
+// of alignment operations as they are visited, each run is split only at
+// window boundaries so the cost does not depend on the number of bases,
+// runs are appended to cigar as well if it is given
+class BreakingPointFinder {
+public:
+    BreakingPointFinder(uint32_t q_begin, uint32_t t_begin, uint32_t t_end,
+        uint32_t window_length, std::vector<std::pair<uint32_t, uint32_t>>& dst,
+        std::vector<uint32_t>* cigar = nullptr)
+            : window_length_(window_length), t_end_(t_end),
+            window_end_(std::min<uint64_t>((t_begin / window_length + 1) *
+                static_cast<uint64_t>(window_length), t_end)),
+            found_first_match_(false), first_match_(0, 0), last_match_(0, 0),
+            q_pos_(q_begin), t_pos_(t_begin), dst_(dst), cigar_(cigar) {
+    }
+
+    void add(uint32_t operation, uint32_t num_bases) {
+        if (cigar_ != nullptr && num_bases > 0) {
+            if (!cigar_->empty() && cigarOperation(cigar_->back()) == operation) {
+                cigar_->back() += packCigar(num_bases, 0);
+            } else {
+                cigar_->emplace_back(packCigar(num_bases, operation));
+            }
+        }
+
+        bool is_match = operation == kCigarMatch || operation == kCigarEqual ||
+            operation == kCigarMismatch;
+        if (operation == kCigarInsertion) {
+            q_pos_ += num_bases;
+        } else if (is_match || operation == kCigarDeletion ||
+            operation == kCigarSkip) {
+
+            while (num_bases > 0) {
+                // bases past the last window are not assigned to any
+                uint64_t length = t_pos_ < window_end_ ?
+                    std::min<uint64_t>(num_bases, window_end_ - t_pos_) : num_bases;
+                if (is_match) {
+                    if (!found_first_match_) {
+                        found_first_match_ = true;
+                        first_match_.first = t_pos_;
+                        first_match_.second = q_pos_;
+                    }
+                    q_pos_ += length;
+                    last_match_.first = t_pos_ + length;
+                    last_match_.second = q_pos_;
+                }
+                t_pos_ += length;
+                num_bases -= length;
+                if (t_pos_ == window_end_) {
+                    end_window();
+                }
+            }
+        }
+    }
+
+private:
+    void end_window() {
+        if (found_first_match_) {
+            dst_.emplace_back(first_match_);
+            dst_.emplace_back(last_match_);
+        }
+        found_first_match_ = false;
+        window_end_ = window_end_ < t_end_ ?
+            std::min(window_end_ + window_length_, t_end_) : 0;
+    }
+
+    uint64_t window_length_;
+    uint64_t t_end_;
+    // exclusive end of the current window
+    uint64_t window_end_;
+    bool found_first_match_;
+    std::pair<uint32_t, uint32_t> first_match_, last_match_;
+    uint64_t q_pos_;
+    uint64_t t_pos_;
+    std::vector<std::pair<uint32_t, uint32_t>>& dst_;
+    std::vector<uint32_t>* cigar_;
+};
+
 Overlap::Overlap(uint64_t a_id, uint64_t b_id, double, uint32_t,
     uint32_t a_rc, uint32_t a_begin, uint32_t a_end, uint32_t a_length,
     uint32_t b_rc, uint32_t b_begin, uint32_t b_end, uint32_t b_length)
@@ -19,7 +213,7 @@ Overlap::Overlap(uint64_t a_id, uint64_t b_id, double, uint32_t,
         q_length_(a_length), t_name_(), t_id_(b_id - 1), t_begin_(b_begin),
         t_end_(b_end), t_length_(b_length), strand_(a_rc ^ b_rc), length_(),
         error_(), cigar_(), is_valid_(true), is_transmuted_(false),
-        breaking_points_() {
+        breaking_points_(), q_sequence_() {
 
     length_ = std::max(q_end_ - q_begin_, t_end_ - t_begin_);
     error_ = 1 - std::min(q_end_ - q_begin_, t_end_ - t_begin_) /
@@ -29,123 +223,146 @@ Overlap::Overlap(uint64_t a_id, uint64_t b_id, double, uint32_t,
 Overlap::Overlap(const char* q_name, uint32_t q_name_length, uint32_t q_length,
     uint32_t q_begin, uint32_t q_end, char orientation, const char* t_name,
     uint32_t t_name_length, uint32_t t_length, uint32_t t_begin,
-    uint32_t t_end, uint32_t, uint32_t, uint32_t)
+    uint32_t t_end, const std::vector<uint32_t>& cigar)
         : q_name_(q_name, q_name_length), q_id_(), q_begin_(q_begin),
         q_end_(q_end), q_length_(q_length), t_name_(t_name, t_name_length),
         t_id_(), t_begin_(t_begin), t_end_(t_end), t_length_(t_length),
-        strand_(orientation == '-'), length_(), error_(), cigar_(),
-        is_valid_(true), is_transmuted_(false), breaking_points_() {
+        strand_(orientation == '-'), length_(), error_(), cigar_(cigar),
+        is_valid_(true), is_transmuted_(false), breaking_points_(),
+        q_sequence_() {
 
     length_ = std::max(q_end_ - q_begin_, t_end_ - t_begin_);
     error_ = 1 - std::min(q_end_ - q_begin_, t_end_ - t_begin_) /
         static_cast<double>(length_);
+
+    if (cigar_.empty()) {
+        return;
+    }
+
+    // the alignment has to span the overlap exactly
+    uint64_t q_alignment_length = 0, t_alignment_length = 0;
+    for (const auto& it: cigar_) {
+        if (consumesQuery(cigarOperation(it))) {
+            q_alignment_length += cigarLength(it);
+        }
+        if (consumesTarget(cigarOperation(it))) {
+            t_alignment_length += cigarLength(it);
+        }
+    }
+    if (q_alignment_length != q_end_ - q_begin_ ||
+        t_alignment_length != t_end_ - t_begin_) {
+        fprintf(stderr, "[Racon::Overlap::Overlap] error: "
+            "CIGAR does not match coordinates in PAF object!\n");
+        exit(1);
+    }
 }
 
 Overlap::Overlap(const char* q_name, uint32_t q_name_length, uint32_t flag,
     const char* t_name, uint32_t t_name_length, uint32_t t_begin,
-    uint32_t, const char* cigar, uint32_t cigar_length, const char*,
-    uint32_t, uint32_t, uint32_t, const char*, uint32_t, const char*,
-    uint32_t)
+    const char* cigar, uint32_t cigar_length)
         : q_name_(q_name, q_name_length), q_id_(), q_begin_(0), q_end_(),
         q_length_(0), t_name_(t_name, t_name_length), t_id_(), t_begin_(t_begin - 1),
         t_end_(), t_length_(0), strand_(flag & 0x10), length_(), error_(),
-        cigar_(cigar, cigar_length), is_valid_(!(flag & 0x4)),
-        is_transmuted_(false), breaking_points_() {
+        cigar_(), is_valid_(!(flag & 0x4)), is_transmuted_(false),
+        breaking_points_(), q_sequence_() {
 
-    if (cigar_.size() < 2 && is_valid_) {
+    if (!is_valid_) {
+        return;
+    }
+    if (cigar_length < 2) {
         fprintf(stderr, "[Racon::Overlap::Overlap] error: "
             "missing alignment from SAM object!\n");
         exit(1);
-    } else {
-        for (uint32_t i = 0; i < cigar_.size(); ++i) {
-            if (cigar_[i] == 'S' || cigar_[i] == 'H') {
-                q_begin_ = atoi(&cigar_[0]);
-                break;
-            } else if (cigar_[i] == 'M' || cigar_[i] == '=' || cigar_[i] == 'I' ||
-                cigar_[i] == 'D' || cigar_[i] == 'N' || cigar_[i] == 'P' ||
-                cigar_[i] == 'X') {
-                break;
-            }
-        }
-
-        uint32_t q_alignment_length = 0, q_clip_length = 0, t_alignment_length = 0;
-        for (uint32_t i = 0, j = 0; i < cigar_.size(); ++i) {
-            if (cigar_[i] == 'M' || cigar_[i] == '=' || cigar_[i] == 'X') {
-                auto num_bases = atoi(&cigar_[j]);
-                j = i + 1;
-                q_alignment_length += num_bases;
-                t_alignment_length += num_bases;
-            } else if (cigar_[i] == 'I') {
-                auto num_bases = atoi(&cigar_[j]);
-                j = i + 1;
-                q_alignment_length += num_bases;
-            } else if (cigar_[i] == 'D' || cigar_[i] == 'N') {
-                auto num_bases = atoi(&cigar_[j]);
-                j = i + 1;
-                t_alignment_length += num_bases;
-            } else if (cigar_[i] == 'S' || cigar_[i] == 'H') {
-                q_clip_length += atoi(&cigar_[j]);
-                j = i + 1;
-            } else if (cigar_[i] == 'P') {
-                j = i + 1;
-            }
-        }
+    }
+    if (!parseCigar(cigar, cigar_length, cigar_)) {
+        fprintf(stderr, "[Racon::Overlap::Overlap] error: "
+            "invalid CIGAR in SAM object!\n");
+        exit(1);
+    }
 
-        q_end_ = q_begin_ + q_alignment_length;
-        q_length_ = q_clip_length + q_alignment_length;
-        if (strand_) {
-            uint32_t tmp = q_begin_;
-            q_begin_ = q_length_ - q_end_;
-            q_end_ = q_length_ - tmp;
-        }
+    find_coordinates_from_cigar();
+}
 
-        t_end_ = t_begin_ + t_alignment_length;
+Overlap::Overlap(const char* q_name, uint32_t q_name_length, uint32_t flag,
+    const std::string& t_name, uint32_t t_begin, const uint32_t* cigar,
+    uint32_t cigar_length)
+        : q_name_(q_name, q_name_length), q_id_(), q_begin_(0), q_end_(),
+        q_length_(0), t_name_(t_name), t_id_(), t_begin_(t_begin), t_end_(),
+        t_length_(0), strand_(flag & 0x10), length_(), error_(),
+        cigar_(cigar, cigar + cigar_length), is_valid_(!(flag & 0x4)),
+        is_transmuted_(false), breaking_points_(), q_sequence_() {
 
-        length_ = std::max(q_alignment_length, t_alignment_length);
-        error_ = 1 - std::min(q_alignment_length, t_alignment_length) /
-            static_cast<double>(length_);
+    if (!is_valid_) {
+        return;
+    }
+    if (cigar_.empty()) {
+        fprintf(stderr, "[Racon::Overlap::Overlap] error: "
+            "missing alignment from BAM object!\n");
+        exit(1);
+    }
+    for (const auto& it: cigar_) {
+        if (cigarOperation(it) > kCigarMismatch) {
+            fprintf(stderr, "[Racon::Overlap::Overlap] error: "
+                "invalid CIGAR in BAM object!\n");
+            exit(1);
+        }
     }
+
+    find_coordinates_from_cigar();
 }
 
 Overlap::Overlap()
         : q_name_(), q_id_(), q_begin_(), q_end_(), q_length_(), t_name_(),
         t_id_(), t_begin_(), t_end_(), t_length_(), strand_(), length_(),
         error_(), cigar_(), is_valid_(true), is_transmuted_(true),
-        breaking_points_(), dual_breaking_points_() {
+        breaking_points_(), q_sequence_() {
 }
 
-template<typename T>
-bool transmuteId(const std::unordered_map<T, uint64_t>& t_to_id, const T& t,
-    uint64_t& id) {
+Overlap::~Overlap() {
+}
 
-    auto it = t_to_id.find(t);
-    if (it == t_to_id.end()) {
-        return false;
+void Overlap::store_query(uint32_t flag, const char* sequence,
+    uint32_t sequence_length, const char* quality, uint32_t quality_length) {
+
+    // secondary and supplementary records usually lack (parts of) the read
+    if ((flag & 0x900) || sequence_length == 0 || sequence_length != q_length_) {
+        return;
     }
-    id = it->second;
-    return true;
+    q_sequence_ = createSequence(q_name_, sequence, sequence_length, quality,
+        quality_length == sequence_length ? quality_length : 0, strand_);
+}
+
+std::unique_ptr<Sequence> Overlap::release_query(uint64_t ordinal) {
+    std::string().swap(q_name_);
+    q_id_ = ordinal;
+    return std::move(q_sequence_);
 }
 
 void Overlap::transmute(const std::vector<std::unique_ptr<Sequence>>& sequences,
-    const std::unordered_map<std::string, uint64_t>& name_to_id,
-    const std::unordered_map<uint64_t, uint64_t>& id_to_id) {
+    const NameIndex& name_index, const std::vector<uint64_t>& id_to_id,
+    uint64_t targets_size) {
+
+    q_sequence_.reset();
 
     if (!is_valid_ || is_transmuted_) {
         return;
     }
 
     if (!q_name_.empty()) {
-        if (!transmuteId(name_to_id, q_name_ + "q", q_id_)) {
+        if (!name_index.find(q_name_.c_str(), q_name_.size(), NameRole::kQuery,
+            q_id_)) {
             is_valid_ = false;
             return;
         }
         std::string().swap(q_name_);
-    } else if (!transmuteId(id_to_id, q_id_ << 1 | 0, q_id_)) {
+    } else if (q_id_ < id_to_id.size() && id_to_id[q_id_] < sequences.size()) {
+        q_id_ = id_to_id[q_id_];
+    } else {
         is_valid_ = false;
         return;
     }
 
-    if (q_length_ != sequences[q_id_]->data().size()) {
+    if (q_length_ != sequences[q_id_]->length()) {
         fprintf(stderr, "[racon::Overlap::transmute] error: "
             "unequal lengths in sequence and overlap file for sequence %s!\n",
             sequences[q_id_]->name().c_str());
@@ -153,17 +370,18 @@ void Overlap::transmute(const std::vector<std::unique_ptr<Sequence>>& sequences,
     }
 
     if (!t_name_.empty()) {
-        if (!transmuteId(name_to_id, t_name_ + "t", t_id_)) {
+        if (!name_index.find(t_name_.c_str(), t_name_.size(), NameRole::kTarget,
+            t_id_)) {
             is_valid_ = false;
             return;
         }
         std::string().swap(t_name_);
-    } else if (!transmuteId(id_to_id, t_id_ << 1 | 1, t_id_)) {
+    } else if (t_id_ >= targets_size) {
         is_valid_ = false;
         return;
     }
 
-    if (t_length_ != 0 && t_length_ != sequences[t_id_]->data().size()) {
+    if (t_length_ != 0 && t_length_ != sequences[t_id_]->length()) {
         fprintf(stderr, "[racon::Overlap::transmute] error: "
             "unequal lengths in target and overlap file for target %s!\n",
             sequences[t_id_]->name().c_str());
@@ -171,13 +389,57 @@ void Overlap::transmute(const std::vector<std::unique_ptr<Sequence>>& sequences,
     }
 
     // for SAM input
-    t_length_ = sequences[t_id_]->data().size();
+    t_length_ = sequences[t_id_]->length();
 
     is_transmuted_ = true;
 }
 
+void Overlap::find_coordinates_from_cigar() {
+
+    uint32_t first_operation = cigarOperation(cigar_.front());
+    if (first_operation == kCigarSoftClip || first_operation == kCigarHardClip) {
+        q_begin_ = cigarLength(cigar_.front());
+    }
+
+    uint32_t q_alignment_length = 0, q_clip_length = 0, t_alignment_length = 0;
+    for (const auto& it: cigar_) {
+        uint32_t operation = cigarOperation(it);
+        if (operation == kCigarSoftClip || operation == kCigarHardClip) {
+            q_clip_length += cigarLength(it);
+            continue;
+        }
+        if (consumesQuery(operation)) {
+            q_alignment_length += cigarLength(it);
+        }
+        if (consumesTarget(operation)) {
+            t_alignment_length += cigarLength(it);
+        }
+    }
+
+    q_end_ = q_begin_ + q_alignment_length;
+    q_length_ = q_clip_length + q_alignment_length;
+    if (strand_) {
+        uint32_t tmp = q_begin_;
+        q_begin_ = q_length_ - q_end_;
+        q_end_ = q_length_ - tmp;
+    }
+
+    t_end_ = t_begin_ + t_alignment_length;
+
+    length_ = std::max(q_alignment_length, t_alignment_length);
+    error_ = 1 - std::min(q_alignment_length, t_alignment_length) /
+        static_cast<double>(length_);
+}
+
+bool Overlap::is_dual(const Overlap& other) const {
+    return q_id_ == other.t_id_ && t_id_ == other.q_id_ &&
+        strand_ == other.strand_ && q_begin_ == other.t_begin_ &&
+        q_end_ == other.t_end_ && t_begin_ == other.q_begin_ &&
+        t_end_ == other.q_end_;
+}
+
 void Overlap::find_breaking_points(const std::vector<std::unique_ptr<Sequence>>& sequences,
-    uint32_t window_length) {
+    uint32_t window_length, double error_threshold, Overlap* dual) {
 
     if (!is_transmuted_) {
         fprintf(stderr, "[racon::Overlap::find_breaking_points] error: "
@@ -190,105 +452,188 @@ void Overlap::find_breaking_points(const std::vector<std::unique_ptr<Sequence>>&
     }
 
     if (cigar_.empty()) {
-        const char* q = !strand_ ? &(sequences[q_id_]->data()[q_begin_]) :
-            &(sequences[q_id_]->reverse_complement()[q_length_ - q_end_]);
-        const char* t = &(sequences[t_id_]->data()[t_begin_]);
-
-        align_overlaps(q, q_end_ - q_begin_, t, t_end_ - t_begin_);
+        // per thread scratch buffers for decoded sequences
+        thread_local std::string q, t;
+        q.resize(q_end_ - q_begin_);
+        sequences[q_id_]->decode_data(strand_ ? q_length_ - q_end_ : q_begin_,
+            q.size(), strand_, &q[0]);
+        t.resize(t_end_ - t_begin_);
+        sequences[t_id_]->decode_data(t_begin_, t.size(), 0, &t[0]);
+
+        // breaking points are collected straight from the alignment path,
+        // overlaps above the error threshold are left without them (the
+        // alignment is kept only if it is needed for the dual overlap)
+        align_overlaps(q.data(), q.size(), t.data(), t.size(), window_length,
+            error_threshold, dual != nullptr);
+    } else {
+        find_breaking_points_from_cigar(window_length);
     }
 
-    find_breaking_points_from_cigar(window_length);
+    if (dual != nullptr && !cigar_.empty()) {
+        dual->find_dual_breaking_points(cigar_, window_length);
+    }
 
-    std::string().swap(cigar_);
+    std::vector<uint32_t>().swap(cigar_);
 }
 
-void Overlap::align_overlaps(const char* q, uint32_t q_length, const char* t, uint32_t t_length)
+void Overlap::align_overlaps(const char* q, uint32_t q_length, const char* t,
+    uint32_t t_length, uint32_t window_length, double error_threshold,
+    bool store_cigar)
 {
-    // align overlaps with edlib
-    EdlibAlignResult result = edlibAlign(q, q_length, t, t_length,
-            edlibNewAlignConfig(-1, EDLIB_MODE_NW, EDLIB_TASK_PATH,
-                nullptr, 0));
-
-    if (result.status == EDLIB_STATUS_OK) {
-        char* cigar = edlibAlignmentToCigar(result.alignment,
-                result.alignmentLength, EDLIB_CIGAR_STANDARD);
-        cigar_ = cigar;
-        free(cigar);
-    } else {
-        fprintf(stderr, "[racon::Overlap::find_breaking_points] error: "
-                "edlib unable to align pair (%zu x %zu)!\n", q_id_, t_id_);
-        exit(1);
+    // align overlaps with edlib, the edit distance is bounded by the error
+    // threshold (at least by the length difference) and the bound is doubled
+    // once on failure (the threshold is checked against length differences
+    // which underestimate edit distances), overlaps exceeding it are left
+    // without breaking points
+    uint32_t length = std::max(q_length, t_length);
+    uint32_t k = std::min(static_cast<double>(length), std::max(
+        std::ceil(error_threshold * length),
+        static_cast<double>(length - std::min(q_length, t_length))));
+    uint32_t max_k = std::min(length, kMaxDistanceFactor * k);
+
+    if (length >= kAnchoredAlignmentLength &&
+        align_overlaps_with_anchors(q, q_length, t, t_length, window_length,
+            max_k, store_cigar)) {
+        return;
     }
 
-    edlibFreeAlignResult(result);
-}
+    while (true) {
+        EdlibAlignResult result = edlibAlign(q, q_length, t, t_length,
+                edlibNewAlignConfig(k, EDLIB_MODE_NW, EDLIB_TASK_PATH,
+                    nullptr, 0));
 
-void Overlap::find_breaking_points_from_cigar(uint32_t window_length)
-{
-    // find breaking points from cigar
-    std::vector<int32_t> window_ends;
-    for (uint32_t i = 0; i < t_end_; i += window_length) {
-        if (i > t_begin_) {
-            window_ends.emplace_back(i - 1);
+        if (result.status != EDLIB_STATUS_OK) {
+            fprintf(stderr, "[racon::Overlap::find_breaking_points] error: "
+                    "edlib unable to align pair (%zu x %zu)!\n", q_id_, t_id_);
+            exit(1);
         }
-    }
-    window_ends.emplace_back(t_end_ - 1);
 
-    uint32_t w = 0;
-    bool found_first_match = false;
-    std::pair<uint32_t, uint32_t> first_match = {0, 0}, last_match = {0, 0};
+        bool is_aligned = result.editDistance >= 0;
+        if (is_aligned) {
+            BreakingPointFinder finder(strand_ ? q_length_ - q_end_ : q_begin_,
+                t_begin_, t_end_, window_length, breaking_points_,
+                store_cigar ? &cigar_ : nullptr);
+            forEachAlignmentRun(result.alignment, result.alignmentLength,
+                [&finder] (uint32_t operation, uint32_t num_bases) -> void {
+                    finder.add(operation, num_bases);
+                });
+        }
+        edlibFreeAlignResult(result);
 
-    int32_t q_ptr = (strand_ ? (q_length_ - q_end_) : q_begin_) - 1;
-    int32_t t_ptr = t_begin_ - 1;
+        if (is_aligned || k >= max_k) {
+            break;
+        }
+        k = max_k;
+    }
+}
 
-    for (uint32_t i = 0, j = 0; i < cigar_.size(); ++i) {
-        if (cigar_[i] == 'M' || cigar_[i] == '=' || cigar_[i] == 'X') {
-            uint32_t k = 0, num_bases = atoi(&cigar_[j]);
-            j = i + 1;
-            while (k < num_bases) {
-                ++q_ptr;
-                ++t_ptr;
+bool Overlap::align_overlaps_with_anchors(const char* q, uint32_t q_length,
+    const char* t, uint32_t t_length, uint32_t window_length,
+    uint32_t max_distance, bool store_cigar) {
 
-                if (!found_first_match) {
-                    found_first_match = true;
-                    first_match.first = t_ptr;
-                    first_match.second = q_ptr;
-                }
-                last_match.first = t_ptr + 1;
-                last_match.second = q_ptr + 1;
-                if (t_ptr == window_ends[w]) {
-                    if (found_first_match) {
-                        breaking_points_.emplace_back(first_match);
-                        breaking_points_.emplace_back(last_match);
-                    }
-                    found_first_match = false;
-                    ++w;
-                }
-
-                ++k;
+    auto anchors = findAnchors(q, q_length, t, t_length, max_distance /
+        static_cast<double>(std::max(q_length, t_length)));
+    if (anchors.empty()) {
+        return false;
+    }
+    anchors.emplace_back(q_length, t_length);
+
+    BreakingPointFinder finder(strand_ ? q_length_ - q_end_ : q_begin_,
+        t_begin_, t_end_, window_length, breaking_points_,
+        store_cigar ? &cigar_ : nullptr);
+    auto append = [&finder] (uint32_t operation, uint32_t num_bases) -> void {
+        finder.add(operation, num_bases);
+    };
+
+    // each segment is aligned within the distance left, the whole overlap is
+    // aligned at once as soon as a segment exceeds it (segments can only sum
+    // up to more than the optimal distance), segments are aligned one after
+    // another as the overlap is already a task of the thread pool
+    bool is_aligned = true;
+    uint64_t distance = 0;
+    uint32_t q_begin = 0, t_begin = 0;
+    for (const auto& it: anchors) {
+        uint32_t q_segment_length = it.first - q_begin;
+        uint32_t t_segment_length = it.second - t_begin;
+
+        if (q_segment_length == 0 || t_segment_length == 0) {
+            append(kCigarInsertion, q_segment_length);
+            append(kCigarDeletion, t_segment_length);
+            distance += q_segment_length + t_segment_length;
+        } else {
+            EdlibAlignResult result = edlibAlign(q + q_begin, q_segment_length,
+                    t + t_begin, t_segment_length, edlibNewAlignConfig(
+                        static_cast<int>(max_distance - distance), EDLIB_MODE_NW,
+                        EDLIB_TASK_PATH, nullptr, 0));
+
+            if (result.status != EDLIB_STATUS_OK) {
+                fprintf(stderr, "[racon::Overlap::find_breaking_points] error: "
+                        "edlib unable to align pair (%zu x %zu)!\n", q_id_, t_id_);
+                exit(1);
             }
-        } else if (cigar_[i] == 'I') {
-            q_ptr += atoi(&cigar_[j]);
-            j = i + 1;
-        } else if (cigar_[i] == 'D' || cigar_[i] == 'N') {
-            uint32_t k = 0, num_bases = atoi(&cigar_[j]);
-            j = i + 1;
-            while (k < num_bases) {
-                ++t_ptr;
-                if (t_ptr == window_ends[w]) {
-                    if (found_first_match) {
-                        breaking_points_.emplace_back(first_match);
-                        breaking_points_.emplace_back(last_match);
-                    }
-                    found_first_match = false;
-                    ++w;
-                }
-                ++k;
+
+            if (result.editDistance < 0) {
+                distance = static_cast<uint64_t>(max_distance) + 1;
+            } else {
+                forEachAlignmentRun(result.alignment, result.alignmentLength, append);
+                distance += result.editDistance;
             }
-        } else if (cigar_[i] == 'S' || cigar_[i] == 'H' || cigar_[i] == 'P') {
-            j = i + 1;
+            edlibFreeAlignResult(result);
+        }
+
+        if (distance > max_distance) {
+            is_aligned = false;
+            break;
+        }
+
+        if (it.first == q_length) {
+            break;
         }
+        append(kCigarMatch, kAnchorLength);
+        q_begin = it.first + kAnchorLength;
+        t_begin = it.second + kAnchorLength;
+    }
+
+    if (!is_aligned) {
+        std::vector<std::pair<uint32_t, uint32_t>>().swap(breaking_points_);
+        std::vector<uint32_t>().swap(cigar_);
     }
+    return is_aligned;
+}
+
+void Overlap::find_breaking_points_from_cigar(uint32_t window_length)
+{
+    BreakingPointFinder finder(strand_ ? q_length_ - q_end_ : q_begin_,
+        t_begin_, t_end_, window_length, breaking_points_);
+    for (const auto& it: cigar_) {
+        finder.add(cigarOperation(it), cigarLength(it));
+    }
+}
+
+void Overlap::find_dual_breaking_points(const std::vector<uint32_t>& cigar,
+    uint32_t window_length)
+{
+    // query and target of the dual are swapped, as are insertions and
+    // deletions, and on the reverse strand the alignment is read backwards
+    BreakingPointFinder finder(strand_ ? q_length_ - q_end_ : q_begin_,
+        t_begin_, t_end_, window_length, breaking_points_);
+    auto add = [&finder] (uint32_t packed) -> void {
+        uint32_t operation = cigarOperation(packed);
+        if (operation == kCigarInsertion) {
+            operation = kCigarDeletion;
+        } else if (operation == kCigarDeletion || operation == kCigarSkip) {
+            operation = kCigarInsertion;
+        }
+        finder.add(operation, cigarLength(packed));
+    };
+    if (strand_) {
+        std::for_each(cigar.rbegin(), cigar.rend(), add);
+    } else {
+        std::for_each(cigar.begin(), cigar.end(), add);
+    }
+
+    // the own alignment (SAM/BAM, PAF with cg:Z) is not needed anymore
+    std::vector<uint32_t>().swap(cigar_);
 }
 
 }
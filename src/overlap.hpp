@@ -12,31 +12,33 @@
 #include <vector>
 #include <string>
 #include <utility>
-#include <unordered_map>
 
 namespace bioparser {
     template<class T>
     class MhapParser;
-
-    template<class T>
-    class PafParser;
-
-    template<class T>
-    class SamParser;
 }
 
 namespace racon {
 
 class Sequence;
+class NameIndex;
 
 class Overlap {
 public:
-    ~Overlap() = default;
+    ~Overlap();
+
+    const std::string& q_name() const {
+        return q_name_;
+    }
 
     uint32_t q_id() const {
         return q_id_;
     }
 
+    const std::string& t_name() const {
+        return t_name_;
+    }
+
     uint32_t t_id() const {
         return t_id_;
     }
@@ -49,9 +51,21 @@ public:
         return is_valid_;
     }
 
+    /*!
+     * @brief Returns the read stored along a primary SAM/BAM record (nullptr
+     * if there is none) and replaces the query name with ordinal which is
+     * mapped through id_to_id in transmute()
+     */
+    std::unique_ptr<Sequence> release_query(uint64_t ordinal);
+
+    /*!
+     * @brief Replaces names (PAF/SAM) or file ordinals (MHAP) with sequence
+     * ids, id_to_id maps ordinals of reads while ordinals of targets are
+     * equal to their ids
+     */
     void transmute(const std::vector<std::unique_ptr<Sequence>>& sequences,
-        const std::unordered_map<std::string, uint64_t>& name_to_id,
-        const std::unordered_map<uint64_t, uint64_t>& id_to_id);
+        const NameIndex& name_index, const std::vector<uint64_t>& id_to_id,
+        uint64_t targets_size);
 
     uint32_t length() const {
         return length_;
@@ -61,7 +75,8 @@ public:
         return error_;
     }
 
-    const std::string& cigar() const {
+    // operations packed as in BAM (see cigar.hpp)
+    const std::vector<uint32_t>& cigar() const {
         return cigar_;
     }
 
@@ -69,12 +84,25 @@ public:
         return breaking_points_;
     }
 
+    /*!
+     * @brief Returns true if other covers the same bases with query and target
+     * swapped (e.g. A to B and B to A in all-vs-all overlaps)
+     */
+    bool is_dual(const Overlap& other) const;
+
+    /*!
+     * @brief Overlaps without alignment whose edit distance exceeds twice
+     * error_threshold times their length are left without breaking points,
+     * breaking points of dual (if given) are found from the same alignment
+     */
     void find_breaking_points(const std::vector<std::unique_ptr<Sequence>>& sequences,
-        uint32_t window_length);
+        uint32_t window_length, double error_threshold, Overlap* dual = nullptr);
 
     friend bioparser::MhapParser<Overlap>;
-    friend bioparser::PafParser<Overlap>;
-    friend bioparser::SamParser<Overlap>;
+    friend class BamParser;
+    friend class PafParser;
+    friend class SamParser;
+    friend class OverlapCache;
 
 #ifdef CUDA_ENABLED
     friend class CUDABatchAligner;
@@ -83,22 +111,44 @@ private:
     Overlap(uint64_t a_id, uint64_t b_id, double accuracy, uint32_t minmers,
         uint32_t a_rc, uint32_t a_begin, uint32_t a_end, uint32_t a_length,
         uint32_t b_rc, uint32_t b_begin, uint32_t b_end, uint32_t b_length);
+    // PAF line, cigar holds packed operations from the cg:Z or cs:Z tag (if any)
     Overlap(const char* q_name, uint32_t q_name_length, uint32_t q_length,
         uint32_t q_begin, uint32_t q_end, char orientation, const char* t_name,
         uint32_t t_name_length, uint32_t t_length, uint32_t t_begin,
-        uint32_t t_end, uint32_t matching_bases, uint32_t overlap_length,
-        uint32_t maping_quality);
+        uint32_t t_end, const std::vector<uint32_t>& cigar);
+    // SAM record, t_begin is 1-based and cigar is text
     Overlap(const char* q_name, uint32_t q_name_length, uint32_t flag,
         const char* t_name, uint32_t t_name_length, uint32_t t_begin,
-        uint32_t mapping_quality, const char* cigar, uint32_t cigar_length,
-        const char* t_next_name, uint32_t t_next_name_length,
-        uint32_t t_next_begin, uint32_t template_length, const char* sequence,
-        uint32_t sequence_length, const char* quality, uint32_t quality_length);
+        const char* cigar, uint32_t cigar_length);
+    // BAM record, t_begin is 0-based and cigar holds packed operations
+    Overlap(const char* q_name, uint32_t q_name_length, uint32_t flag,
+        const std::string& t_name, uint32_t t_begin, const uint32_t* cigar,
+        uint32_t cigar_length);
     Overlap();
     Overlap(const Overlap&) = delete;
     const Overlap& operator=(const Overlap&) = delete;
+    // sets query and target coordinates, length and error from cigar_
+    void find_coordinates_from_cigar();
     virtual void find_breaking_points_from_cigar(uint32_t window_length);
-    virtual void align_overlaps(const char* q, uint32_t q_len, const char* t, uint32_t t_len);
+    // aligns q to t and finds breaking points, the alignment is stored in
+    // cigar_ only if store_cigar is set
+    virtual void align_overlaps(const char* q, uint32_t q_len, const char* t,
+        uint32_t t_len, uint32_t window_length, double error_threshold,
+        bool store_cigar);
+    // aligns segments between anchors one by one and finds breaking points of
+    // their concatenation, returns false if there are no anchors or if the
+    // segments exceed max_distance
+    bool align_overlaps_with_anchors(const char* q, uint32_t q_length,
+        const char* t, uint32_t t_length, uint32_t window_length,
+        uint32_t max_distance, bool store_cigar);
+    // keeps bases and qualities (decoded to text) of primary records which
+    // are not hard clipped, called by SAM/BAM parsers if reads are taken
+    // from their records
+    void store_query(uint32_t flag, const char* sequence,
+        uint32_t sequence_length, const char* quality, uint32_t quality_length);
+    // finds breaking points from cigar of the dual overlap
+    void find_dual_breaking_points(const std::vector<uint32_t>& cigar,
+        uint32_t window_length);
 
     std::string q_name_;
     uint64_t q_id_;
@@ -115,12 +165,14 @@ private:
     uint32_t strand_;
     uint32_t length_;
     double error_;
-    std::string cigar_;
+    std::vector<uint32_t> cigar_;
 
     bool is_valid_;
     bool is_transmuted_;
     std::vector<std::pair<uint32_t, uint32_t>> breaking_points_;
-    std::vector<std::pair<uint32_t, uint32_t>> dual_breaking_points_;
+
+    // read of a SAM/BAM record, freed on transmute() unless released
+    std::unique_ptr<Sequence> q_sequence_;
 };
 
 }
@@ -0,0 +1,301 @@
+/*!
+ * @file overlap_cache.cpp
+ *
+ * @brief OverlapCache class source file
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "overlap.hpp"
+#include "polisher.hpp"
+#include "overlap_cache.hpp"
+
+namespace racon {
+
+constexpr char kMagic[] = "RACONOC3";
+constexpr uint32_t kMagicLength = 8;
+constexpr uint32_t kFingerprintLength = 1024 * 1024; // ~ 1MB
+constexpr uint32_t kBufferSize = 1024 * 1024; // ~ 1MB
+
+std::string fingerprint(const std::string& path) {
+
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        fprintf(stderr, "[racon::createOverlapCache] error: "
+            "unable to stat file %s!\n", path.c_str());
+        exit(1);
+    }
+
+    FILE* input = fopen(path.c_str(), "rb");
+    if (input == nullptr) {
+        fprintf(stderr, "[racon::createOverlapCache] error: "
+            "unable to open file %s!\n", path.c_str());
+        exit(1);
+    }
+    std::vector<unsigned char> buffer(kFingerprintLength);
+    size_t buffer_length = fread(buffer.data(), 1, buffer.size(), input);
+    fclose(input);
+
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < buffer_length; ++i) {
+        hash = (hash ^ buffer[i]) * 1099511628211ULL;
+    }
+
+    return std::to_string(st.st_size) + " " + std::to_string(st.st_mtime) +
+        " " + std::to_string(hash);
+}
+
+std::unique_ptr<OverlapCache> createOverlapCache(const std::string& path,
+    const std::string& sequences_path, const std::string& overlaps_path,
+    const std::string& target_path, PolisherType type, uint32_t window_length,
+    double error_threshold, bool lazy_loading, uint32_t shard,
+    uint32_t num_shards) {
+
+    if (path.empty()) {
+        return nullptr;
+    }
+
+    char parameters[128];
+    snprintf(parameters, sizeof(parameters), "%u %u %a %d %u/%u",
+        static_cast<uint32_t>(type), window_length, error_threshold,
+        lazy_loading, shard, num_shards);
+
+    std::string key = fingerprint(sequences_path) + "\n" +
+        fingerprint(overlaps_path) + "\n" + fingerprint(target_path) + "\n" +
+        parameters + "\n";
+
+    return std::unique_ptr<OverlapCache>(new OverlapCache(path, key));
+}
+
+void writeVarint(std::vector<unsigned char>& dst, uint64_t value) {
+    while (value >= 0x80) {
+        dst.emplace_back((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    dst.emplace_back(value);
+}
+
+// deltas are zigzag encoded so that small negative values stay short
+void writeDelta(std::vector<unsigned char>& dst, uint64_t value, uint64_t& prev) {
+    int64_t delta = static_cast<int64_t>(value - prev);
+    writeVarint(dst, (static_cast<uint64_t>(delta) << 1) ^ (delta >> 63));
+    prev = value;
+}
+
+class CacheReader {
+public:
+    CacheReader(const std::string& path)
+            : input_(fopen(path.c_str(), "rb")), buffer_(kBufferSize),
+            begin_(0), end_(0) {
+    }
+
+    ~CacheReader() {
+        if (input_ != nullptr) {
+            fclose(input_);
+        }
+    }
+
+    bool is_open() const {
+        return input_ != nullptr;
+    }
+
+    // returns false at the end of file
+    bool read_byte(unsigned char& byte) {
+        if (begin_ == end_) {
+            begin_ = 0;
+            end_ = fread(buffer_.data(), 1, buffer_.size(), input_);
+            if (end_ == 0) {
+                return false;
+            }
+        }
+        byte = buffer_[begin_++];
+        return true;
+    }
+
+    bool read_varint(uint64_t& value) {
+        value = 0;
+        unsigned char byte;
+        for (uint32_t shift = 0; shift < 64; shift += 7) {
+            if (!read_byte(byte)) {
+                return false;
+            }
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool read_delta(uint64_t& value, uint64_t& prev) {
+        uint64_t zigzag;
+        if (!read_varint(zigzag)) {
+            return false;
+        }
+        value = prev + ((zigzag >> 1) ^ -(zigzag & 1));
+        prev = value;
+        return true;
+    }
+
+    bool read_header(std::string& key) {
+        unsigned char byte;
+        for (uint32_t i = 0; i < kMagicLength; ++i) {
+            if (!read_byte(byte) || byte != static_cast<unsigned char>(kMagic[i])) {
+                return false;
+            }
+        }
+        uint64_t key_length;
+        if (!read_varint(key_length) || key_length > kBufferSize) {
+            return false;
+        }
+        key.clear();
+        for (uint64_t i = 0; i < key_length; ++i) {
+            if (!read_byte(byte)) {
+                return false;
+            }
+            key += byte;
+        }
+        return true;
+    }
+
+private:
+    FILE* input_;
+    std::vector<unsigned char> buffer_;
+    size_t begin_;
+    size_t end_;
+};
+
+OverlapCache::OverlapCache(const std::string& path, const std::string& key)
+        : path_(path), key_(key), is_hit_(false), output_(nullptr),
+        q_id_prev_(0) {
+
+    CacheReader reader(path_);
+    std::string cached_key;
+    is_hit_ = reader.is_open() && reader.read_header(cached_key) &&
+        cached_key == key_;
+}
+
+OverlapCache::~OverlapCache() {
+    if (output_ != nullptr) {
+        fclose(output_);
+        remove((path_ + ".tmp").c_str());
+    }
+}
+
+void OverlapCache::load(uint64_t targets_begin, uint64_t targets_end,
+    std::vector<std::unique_ptr<Overlap>>& dst,
+    std::vector<uint64_t>* targets_bases) const {
+
+    CacheReader reader(path_);
+    std::string key;
+    if (!reader.is_open() || !reader.read_header(key) || key != key_) {
+        fprintf(stderr, "[racon::OverlapCache::load] error: "
+            "unable to read cache %s!\n", path_.c_str());
+        exit(1);
+    }
+
+    uint64_t q_id = 0, q_id_prev = 0, t_id, strand, length, error,
+        num_breaking_points;
+    while (reader.read_delta(q_id, q_id_prev)) {
+        if (!reader.read_varint(t_id) || !reader.read_varint(strand) ||
+            !reader.read_varint(length) || !reader.read_varint(error) ||
+            !reader.read_varint(num_breaking_points)) {
+            fprintf(stderr, "[racon::OverlapCache::load] error: "
+                "cache %s is truncated!\n", path_.c_str());
+            exit(1);
+        }
+
+        std::unique_ptr<Overlap> overlap(new Overlap());
+        overlap->q_id_ = q_id;
+        overlap->t_id_ = t_id;
+        overlap->strand_ = strand;
+        overlap->length_ = length;
+        memcpy(&overlap->error_, &error, sizeof(error));
+        overlap->breaking_points_.reserve(num_breaking_points);
+
+        uint64_t first = 0, second = 0, first_prev = 0, second_prev = 0;
+        for (uint64_t i = 0; i < num_breaking_points; ++i) {
+            if (!reader.read_delta(first, first_prev) ||
+                !reader.read_delta(second, second_prev)) {
+                fprintf(stderr, "[racon::OverlapCache::load] error: "
+                    "cache %s is truncated!\n", path_.c_str());
+                exit(1);
+            }
+            overlap->breaking_points_.emplace_back(first, second);
+        }
+
+        if (targets_bases != nullptr && t_id < targets_bases->size()) {
+            (*targets_bases)[t_id] += length;
+        }
+        if (t_id >= targets_begin && t_id < targets_end) {
+            dst.emplace_back(std::move(overlap));
+        }
+    }
+}
+
+void OverlapCache::store(const std::vector<std::unique_ptr<Overlap>>& overlaps) {
+
+    std::vector<unsigned char> buffer;
+    if (output_ == nullptr) {
+        output_ = fopen((path_ + ".tmp").c_str(), "wb");
+        if (output_ == nullptr) {
+            fprintf(stderr, "[racon::OverlapCache::store] error: "
+                "unable to create cache %s!\n", path_.c_str());
+            exit(1);
+        }
+        buffer.insert(buffer.end(), kMagic, kMagic + kMagicLength);
+        writeVarint(buffer, key_.size());
+        buffer.insert(buffer.end(), key_.begin(), key_.end());
+    }
+
+    for (const auto& it: overlaps) {
+        if (it == nullptr) {
+            continue;
+        }
+        writeDelta(buffer, it->q_id(), q_id_prev_);
+        writeVarint(buffer, it->t_id());
+        writeVarint(buffer, it->strand());
+        writeVarint(buffer, it->length());
+        // exact bits, layers are ranked by error when --max-depth is used
+        double error = it->error();
+        uint64_t error_bits;
+        memcpy(&error_bits, &error, sizeof(error));
+        writeVarint(buffer, error_bits);
+        writeVarint(buffer, it->breaking_points().size());
+
+        uint64_t first_prev = 0, second_prev = 0;
+        for (const auto& jt: it->breaking_points()) {
+            writeDelta(buffer, jt.first, first_prev);
+            writeDelta(buffer, jt.second, second_prev);
+        }
+
+        if (buffer.size() >= kBufferSize) {
+            fwrite(buffer.data(), 1, buffer.size(), output_);
+            buffer.clear();
+        }
+    }
+    fwrite(buffer.data(), 1, buffer.size(), output_);
+}
+
+void OverlapCache::close() {
+
+    if (output_ == nullptr) {
+        return;
+    }
+
+    bool is_valid = ferror(output_) == 0;
+    is_valid &= fclose(output_) == 0;
+    output_ = nullptr;
+
+    if (!is_valid || rename((path_ + ".tmp").c_str(), path_.c_str()) != 0) {
+        fprintf(stderr, "[racon::OverlapCache::close] error: "
+            "unable to write cache %s!\n", path_.c_str());
+        exit(1);
+    }
+    is_hit_ = true;
+}
+
+}
@@ -0,0 +1,78 @@
+/*!
+ * @file overlap_cache.hpp
+ *
+ * @brief OverlapCache class header file
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <memory>
+#include <vector>
+#include <string>
+
+namespace racon {
+
+class Overlap;
+enum class PolisherType;
+
+class OverlapCache;
+std::unique_ptr<OverlapCache> createOverlapCache(const std::string& path,
+    const std::string& sequences_path, const std::string& overlaps_path,
+    const std::string& target_path, PolisherType type, uint32_t window_length,
+    double error_threshold, bool lazy_loading, uint32_t shard,
+    uint32_t num_shards);
+
+/*!
+ * @brief Binary file storing transmuted overlaps (ids, strand, length, error
+ * and breaking points) which is valid only for the same input files (compared by
+ * size, modification time and a hash of their beginning) and the same
+ * parameters which influence breaking points or sequence ids
+ */
+class OverlapCache {
+public:
+    ~OverlapCache();
+
+    /*!
+     * @brief Returns true if the cache file exists and matches the inputs
+     */
+    bool is_hit() const {
+        return is_hit_;
+    }
+
+    /*!
+     * @brief Appends overlaps with targets in [targets_begin, targets_end) to
+     * dst, breaking points and alignment errors are already set, lengths of
+     * overlaps of all targets are added to targets_bases (if given)
+     */
+    void load(uint64_t targets_begin, uint64_t targets_end,
+        std::vector<std::unique_ptr<Overlap>>& dst,
+        std::vector<uint64_t>* targets_bases = nullptr) const;
+
+    /*!
+     * @brief Appends overlaps to a temporary file which replaces the cache
+     * file once close() is called
+     */
+    void store(const std::vector<std::unique_ptr<Overlap>>& overlaps);
+
+    void close();
+
+    friend std::unique_ptr<OverlapCache> createOverlapCache(const std::string& path,
+        const std::string& sequences_path, const std::string& overlaps_path,
+        const std::string& target_path, PolisherType type, uint32_t window_length,
+        double error_threshold, bool lazy_loading, uint32_t shard,
+        uint32_t num_shards);
+private:
+    OverlapCache(const std::string& path, const std::string& key);
+    OverlapCache(const OverlapCache&) = delete;
+    const OverlapCache& operator=(const OverlapCache&) = delete;
+
+    std::string path_;
+    std::string key_;
+    bool is_hit_;
+    FILE* output_;
+    uint64_t q_id_prev_;
+};
+
+}
@@ -0,0 +1,39 @@
+/*!
+ * @file overlap_parser.hpp
+ *
+ * @brief OverlapParser class header file
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+namespace thread_pool {
+    class ThreadPool;
+}
+
+namespace racon {
+
+class Overlap;
+
+/*!
+ * @brief Interface of overlap parsers which are implemented in racon instead
+ * of bioparser (formats whose records carry more than bioparser passes on)
+ */
+class OverlapParser {
+public:
+    virtual ~OverlapParser() {}
+
+    virtual void reset() = 0;
+
+    /*!
+     * @brief Returns overlaps from at least bytes of records (or less at the
+     * end of file)
+     */
+    virtual std::vector<std::unique_ptr<Overlap>> parse(uint64_t bytes,
+        const std::shared_ptr<thread_pool::ThreadPool>& thread_pool) = 0;
+};
+
+}
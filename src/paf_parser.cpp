@@ -0,0 +1,177 @@
+/*!
+ * @file paf_parser.cpp
+ *
+ * @brief PafParser class source file
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "overlap.hpp"
+#include "cigar.hpp"
+#include "paf_parser.hpp"
+
+#include "zlib.h"
+
+namespace racon {
+
+constexpr uint32_t kBufferSize = 1024 * 1024; // ~ 1MB
+constexpr uint32_t kNumMandatoryFields = 12;
+
+std::unique_ptr<PafParser> createPafParser(const std::string& path) {
+
+    gzFile input = gzopen(path.c_str(), "r");
+    if (input == nullptr) {
+        fprintf(stderr, "[racon::createPafParser] error: "
+            "unable to open file %s!\n", path.c_str());
+        exit(1);
+    }
+
+    return std::unique_ptr<PafParser>(new PafParser(input, path));
+}
+
+PafParser::PafParser(gzFile input, const std::string& path)
+        : input_(input), path_(path), buffer_(kBufferSize), buffer_begin_(0),
+        buffer_end_(0), line_(), fields_(), cigar_() {
+}
+
+PafParser::~PafParser() {
+    gzclose(input_);
+}
+
+void PafParser::reset() {
+    gzseek(input_, 0, SEEK_SET);
+    buffer_begin_ = 0;
+    buffer_end_ = 0;
+}
+
+bool PafParser::read_line() {
+
+    line_.clear();
+    bool has_data = false;
+    while (true) {
+        if (buffer_begin_ == buffer_end_) {
+            int32_t length = gzread(input_, buffer_.data(), buffer_.size());
+            if (length < 0) {
+                fprintf(stderr, "[racon::PafParser::parse] error: "
+                    "unable to read file %s!\n", path_.c_str());
+                exit(1);
+            }
+            if (length == 0) {
+                break;
+            }
+            buffer_begin_ = 0;
+            buffer_end_ = length;
+        }
+        has_data = true;
+
+        const char* begin = &buffer_[buffer_begin_];
+        const char* end = static_cast<const char*>(memchr(begin, '\n',
+            buffer_end_ - buffer_begin_));
+        if (end == nullptr) {
+            line_.append(begin, buffer_end_ - buffer_begin_);
+            buffer_begin_ = buffer_end_;
+        } else {
+            line_.append(begin, end - begin);
+            buffer_begin_ += end - begin + 1;
+            break;
+        }
+    }
+
+    if (!line_.empty() && line_.back() == '\r') {
+        line_.pop_back();
+    }
+    return has_data;
+}
+
+std::unique_ptr<Overlap> PafParser::parse_line() {
+
+    fields_.clear();
+    const char* begin = line_.c_str();
+    const char* end = begin + line_.size();
+    while (true) {
+        const char* tab = static_cast<const char*>(memchr(begin, '\t', end - begin));
+        fields_.emplace_back(begin, (tab == nullptr ? end : tab) - begin);
+        if (tab == nullptr) {
+            break;
+        }
+        begin = tab + 1;
+    }
+
+    auto number = [] (const std::pair<const char*, uint32_t>& field,
+        uint32_t& dst) -> bool {
+        char* field_end;
+        dst = strtoul(field.first, &field_end, 10);
+        return field.second != 0 && field_end == field.first + field.second;
+    };
+
+    // query length, begin and end followed by those of the target
+    const uint32_t kCoordinateFields[6] = {1, 2, 3, 6, 7, 8};
+    uint32_t values[6];
+    bool is_valid = fields_.size() >= kNumMandatoryFields &&
+        fields_[0].second != 0 && fields_[5].second != 0 &&
+        fields_[4].second == 1 && (fields_[4].first[0] == '+' ||
+        fields_[4].first[0] == '-');
+    for (uint32_t i = 0; is_valid && i < 6; ++i) {
+        is_valid = number(fields_[kCoordinateFields[i]], values[i]);
+    }
+    if (!is_valid) {
+        fprintf(stderr, "[racon::PafParser::parse] error: "
+            "invalid line in file %s!\n", path_.c_str());
+        exit(1);
+    }
+
+    // cg:Z holds a CIGAR, cs:Z differences to the target (used only if there
+    // is no cg:Z)
+    cigar_.clear();
+    const std::pair<const char*, uint32_t>* cs = nullptr;
+    for (uint32_t i = kNumMandatoryFields; i < fields_.size(); ++i) {
+        const auto& it = fields_[i];
+        if (it.second < 5 || it.first[2] != ':' || it.first[3] != 'Z' ||
+            it.first[4] != ':') {
+            continue;
+        }
+        if (it.first[0] == 'c' && it.first[1] == 'g') {
+            if (!parseCigar(it.first + 5, it.second - 5, cigar_)) {
+                fprintf(stderr, "[racon::PafParser::parse] error: "
+                    "invalid cg tag in file %s!\n", path_.c_str());
+                exit(1);
+            }
+            cs = nullptr;
+            break;
+        }
+        if (it.first[0] == 'c' && it.first[1] == 's') {
+            cs = &it;
+        }
+    }
+    if (cs != nullptr && !parseCs(cs->first + 5, cs->second - 5, cigar_)) {
+        fprintf(stderr, "[racon::PafParser::parse] error: "
+            "invalid cs tag in file %s!\n", path_.c_str());
+        exit(1);
+    }
+
+    return std::unique_ptr<Overlap>(new Overlap(fields_[0].first,
+        fields_[0].second, values[0], values[1], values[2], fields_[4].first[0],
+        fields_[5].first, fields_[5].second, values[3], values[4], values[5],
+        cigar_));
+}
+
+std::vector<std::unique_ptr<Overlap>> PafParser::parse(uint64_t bytes,
+    const std::shared_ptr<thread_pool::ThreadPool>&) {
+
+    std::vector<std::unique_ptr<Overlap>> dst;
+
+    uint64_t parsed_bytes = 0;
+    while (parsed_bytes < bytes && read_line()) {
+        parsed_bytes += line_.size() + 1;
+        if (line_.empty()) {
+            continue;
+        }
+        dst.emplace_back(parse_line());
+    }
+
+    return dst;
+}
+
+}
@@ -0,0 +1,60 @@
+/*!
+ * @file paf_parser.hpp
+ *
+ * @brief PafParser class header file
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <vector>
+#include <string>
+#include <utility>
+
+#include "overlap_parser.hpp"
+
+typedef struct gzFile_s* gzFile;
+
+namespace racon {
+
+class PafParser;
+std::unique_ptr<PafParser> createPafParser(const std::string& path);
+
+/*!
+ * @brief Parses overlaps from PAF files (can be compressed with gzip) along
+ * with alignments stored in cg:Z or cs:Z tags (e.g. minimap2 -c) so that they
+ * do not have to be realigned
+ */
+class PafParser: public OverlapParser {
+public:
+    ~PafParser();
+
+    void reset() override;
+
+    std::vector<std::unique_ptr<Overlap>> parse(uint64_t bytes,
+        const std::shared_ptr<thread_pool::ThreadPool>& thread_pool) override;
+
+    friend std::unique_ptr<PafParser> createPafParser(const std::string& path);
+private:
+    PafParser(gzFile input, const std::string& path);
+    PafParser(const PafParser&) = delete;
+    const PafParser& operator=(const PafParser&) = delete;
+
+    // reads the next line into line_ (without the newline), returns false at
+    // the end of file
+    bool read_line();
+    std::unique_ptr<Overlap> parse_line();
+
+    gzFile input_;
+    std::string path_;
+    std::vector<char> buffer_;
+    uint32_t buffer_begin_;
+    uint32_t buffer_end_;
+    std::string line_;
+    // fields of the current line as (begin, length)
+    std::vector<std::pair<const char*, uint32_t>> fields_;
+    std::vector<uint32_t> cigar_;
+};
+
+}
@@ -4,13 +4,18 @@
  * @brief Polisher class source file
  */
 
+#include <math.h>
 #include <algorithm>
-#include <unordered_set>
 #include <iostream>
 
 #include "overlap.hpp"
 #include "sequence.hpp"
 #include "window.hpp"
+#include "overlap_cache.hpp"
+#include "name_index.hpp"
+#include "bam_parser.hpp"
+#include "paf_parser.hpp"
+#include "sam_parser.hpp"
 #include "logger.hpp"
 #include "polisher.hpp"
 #ifdef CUDA_ENABLED
@@ -20,14 +25,54 @@
 #include "bioparser/fasta_parser.hpp"
 #include "bioparser/fastq_parser.hpp"
 #include "bioparser/mhap_parser.hpp"
-#include "bioparser/paf_parser.hpp"
-#include "bioparser/sam_parser.hpp"
 #include "thread_pool/thread_pool.hpp"
 #include "spoa/spoa.hpp"
 
 namespace racon {
 
 constexpr uint32_t kChunkSize = 1024 * 1024 * 1024; // ~ 1GB
+constexpr uint32_t kStreamChunkSize = 64 * 1024 * 1024; // ~ 64MB
+constexpr uint64_t kUnusedRead = -1;
+constexpr uint64_t kNoOverlap = -1;
+constexpr uint64_t kNoDual = -1;
+// automatic maximum depth of windows is a multiple of the median coverage of
+// targets but at least kMinAutoDepth, beyond which layers barely improve the
+// consensus
+constexpr uint32_t kAutoDepthFactor = 2;
+constexpr uint32_t kMinAutoDepth = 60;
+
+// contig polishing uses only the best overlap of each read, i.e. the longest
+// one with ties broken by error, target and strand (and at last by ordinals
+// in the overlap file) so that the choice does not depend on how overlaps
+// are ordered or grouped
+struct OverlapRank {
+    uint64_t ordinal;
+    uint64_t t_id;
+    uint32_t length;
+    uint32_t strand;
+    double error;
+};
+
+bool isBetterOverlap(const Overlap& overlap, uint64_t ordinal,
+    const OverlapRank& rank) {
+
+    if (rank.ordinal == kNoOverlap) {
+        return true;
+    }
+    if (overlap.length() != rank.length) {
+        return overlap.length() > rank.length;
+    }
+    if (overlap.error() != rank.error) {
+        return overlap.error() < rank.error;
+    }
+    if (overlap.t_id() != rank.t_id) {
+        return overlap.t_id() < rank.t_id;
+    }
+    if (overlap.strand() != rank.strand) {
+        return overlap.strand() < rank.strand;
+    }
+    return ordinal < rank.ordinal;
+}
 
 template<class T>
 void shrinkToFit(std::vector<std::unique_ptr<T>>& src, uint64_t begin) {
@@ -59,7 +104,10 @@ std::unique_ptr<Polisher> createPolisher(const std::string& sequences_path,
     PolisherType type, uint32_t window_length, double quality_threshold,
     double error_threshold, bool trim, int8_t match, int8_t mismatch, int8_t gap,
     uint32_t num_threads, uint32_t cudapoa_batches, bool cuda_banded_alignment,
-    uint32_t cudaaligner_batches, uint32_t cudaaligner_band_width) {
+    uint32_t cudaaligner_batches, uint32_t cudaaligner_band_width,
+    uint64_t split_size, const std::string& cache_path, bool lazy_loading,
+    uint32_t shard, uint32_t num_shards, bool target_sorted, int32_t max_depth,
+    uint32_t poa_band_width, double agreement_threshold) {
 
     if (type != PolisherType::kC && type != PolisherType::kF) {
         fprintf(stderr, "[racon::createPolisher] error: invalid polisher type!\n");
@@ -71,9 +119,26 @@ std::unique_ptr<Polisher> createPolisher(const std::string& sequences_path,
         exit(1);
     }
 
+    if (num_shards == 0 || shard >= num_shards) {
+        fprintf(stderr, "[racon::createPolisher] error: invalid shard!\n");
+        exit(1);
+    }
+
+    if (max_depth < -1) {
+        fprintf(stderr, "[racon::createPolisher] error: invalid maximum depth!\n");
+        exit(1);
+    }
+
+    if (agreement_threshold < 0 || agreement_threshold > 1) {
+        fprintf(stderr, "[racon::createPolisher] error: "
+            "invalid agreement threshold!\n");
+        exit(1);
+    }
+
     std::unique_ptr<bioparser::Parser<Sequence>> sparser = nullptr,
         tparser = nullptr;
     std::unique_ptr<bioparser::Parser<Overlap>> oparser = nullptr;
+    std::unique_ptr<OverlapParser> nparser = nullptr;
 
     auto is_suffix = [](const std::string& src, const std::string& suffix) -> bool {
         if (src.size() < suffix.size()) {
@@ -82,7 +147,22 @@ std::unique_ptr<Polisher> createPolisher(const std::string& sequences_path,
         return src.compare(src.size() - suffix.size(), suffix.size(), suffix) == 0;
     };
 
-    if (is_suffix(sequences_path, ".fasta") || is_suffix(sequences_path, ".fasta.gz") ||
+    // reads are taken from SAM/BAM records if there is no sequences file,
+    // breaking points can not be cached then as reads are loaded only while
+    // parsing overlaps
+    if (sequences_path.empty()) {
+        if (!is_suffix(overlaps_path, ".sam") && !is_suffix(overlaps_path, ".sam.gz") &&
+            !is_suffix(overlaps_path, ".bam")) {
+            fprintf(stderr, "[racon::createPolisher] error: "
+                "missing sequences for overlaps which are not in SAM/BAM format!\n");
+            exit(1);
+        }
+        if (!cache_path.empty()) {
+            fprintf(stderr, "[racon::createPolisher] error: "
+                "cache requires sequences!\n");
+            exit(1);
+        }
+    } else if (is_suffix(sequences_path, ".fasta") || is_suffix(sequences_path, ".fasta.gz") ||
         is_suffix(sequences_path, ".fna") || is_suffix(sequences_path, ".fna.gz") ||
         is_suffix(sequences_path, ".fa") || is_suffix(sequences_path, ".fa.gz")) {
         sparser = bioparser::Parser<Sequence>::Create<bioparser::FastaParser>(
@@ -104,15 +184,16 @@ std::unique_ptr<Polisher> createPolisher(const std::string& sequences_path,
         oparser = bioparser::Parser<Overlap>::Create<bioparser::MhapParser>(
             overlaps_path);
     } else if (is_suffix(overlaps_path, ".paf") || is_suffix(overlaps_path, ".paf.gz")) {
-        oparser = bioparser::Parser<Overlap>::Create<bioparser::PafParser>(
-            overlaps_path);
+        nparser = createPafParser(overlaps_path);
     } else if (is_suffix(overlaps_path, ".sam") || is_suffix(overlaps_path, ".sam.gz")) {
-        oparser = bioparser::Parser<Overlap>::Create<bioparser::SamParser>(
-            overlaps_path);
+        nparser = createSamParser(overlaps_path, sparser == nullptr);
+    } else if (is_suffix(overlaps_path, ".bam")) {
+        nparser = createBamParser(overlaps_path, sparser == nullptr);
     } else {
         fprintf(stderr, "[racon::createPolisher] error: "
             "file %s has unsupported format extension (valid extensions: "
-            ".mhap, .mhap.gz, .paf, .paf.gz, .sam, .sam.gz)!\n", overlaps_path.c_str());
+            ".mhap, .mhap.gz, .paf, .paf.gz, .sam, .sam.gz, .bam)!\n",
+            overlaps_path.c_str());
         exit(1);
     }
 
@@ -134,15 +215,21 @@ std::unique_ptr<Polisher> createPolisher(const std::string& sequences_path,
         exit(1);
     }
 
+    auto cache = createOverlapCache(cache_path, sequences_path, overlaps_path,
+        target_path, type, window_length, error_threshold, lazy_loading,
+        shard, num_shards);
+
     if (cudapoa_batches > 0 || cudaaligner_batches > 0)
     {
 #ifdef CUDA_ENABLED
         // If CUDA is enabled, return an instance of the CUDAPolisher object.
         return std::unique_ptr<Polisher>(new CUDAPolisher(std::move(sparser),
-                    std::move(oparser), std::move(tparser), type, window_length,
-                    quality_threshold, error_threshold, trim, match, mismatch, gap,
-                    num_threads, cudapoa_batches, cuda_banded_alignment, cudaaligner_batches,
-                    cudaaligner_band_width));
+                    std::move(oparser), std::move(nparser), std::move(tparser),
+                    type, window_length, quality_threshold, error_threshold, trim,
+                    match, mismatch, gap, num_threads, split_size, lazy_loading,
+                    shard, num_shards, target_sorted, max_depth, poa_band_width,
+                    agreement_threshold, std::move(cache), cudapoa_batches, cuda_banded_alignment,
+                    cudaaligner_batches, cudaaligner_band_width));
 #else
         fprintf(stderr, "[racon::createPolisher] error: "
                 "Attemping to use CUDA when CUDA support is not available.\n"
@@ -156,23 +243,36 @@ std::unique_ptr<Polisher> createPolisher(const std::string& sequences_path,
         (void) cuda_banded_alignment;
         (void) cudaaligner_band_width;
         return std::unique_ptr<Polisher>(new Polisher(std::move(sparser),
-                    std::move(oparser), std::move(tparser), type, window_length,
-                    quality_threshold, error_threshold, trim, match, mismatch, gap,
-                    num_threads));
+                    std::move(oparser), std::move(nparser), std::move(tparser),
+                    type, window_length, quality_threshold, error_threshold, trim,
+                    match, mismatch, gap, num_threads, split_size, lazy_loading,
+                    shard, num_shards, target_sorted, max_depth, poa_band_width,
+                    agreement_threshold, std::move(cache)));
     }
 }
 
 Polisher::Polisher(std::unique_ptr<bioparser::Parser<Sequence>> sparser,
     std::unique_ptr<bioparser::Parser<Overlap>> oparser,
+    std::unique_ptr<OverlapParser> nparser,
     std::unique_ptr<bioparser::Parser<Sequence>> tparser,
     PolisherType type, uint32_t window_length, double quality_threshold,
     double error_threshold, bool trim, int8_t match, int8_t mismatch, int8_t gap,
-    uint32_t num_threads)
+    uint32_t num_threads, uint64_t split_size, bool lazy_loading,
+    uint32_t shard, uint32_t num_shards, bool target_sorted,
+    int32_t max_depth, uint32_t poa_band_width, double agreement_threshold,
+    std::unique_ptr<OverlapCache> cache)
         : sparser_(std::move(sparser)), oparser_(std::move(oparser)),
-        tparser_(std::move(tparser)), type_(type), quality_threshold_(
-        quality_threshold), error_threshold_(error_threshold), trim_(trim),
-        alignment_engines_(), sequences_(), dummy_quality_(window_length, '!'),
-        window_length_(window_length), windows_(),
+        nparser_(std::move(nparser)), tparser_(std::move(tparser)),
+        type_(type), quality_threshold_(quality_threshold),
+        error_threshold_(error_threshold), trim_(trim),
+        alignment_engines_(), consensus_contexts_(), sequences_(), targets_size_(0),
+        targets_coverages_(), split_size_(split_size), targets_splits_(),
+        name_index_(new NameIndex()), id_to_id_(), overlaps_ordinal_(0),
+        lazy_loading_(lazy_loading),
+        shard_(shard), num_shards_(num_shards), target_sorted_(target_sorted),
+        is_streaming_(false), max_depth_(max_depth), cache_(std::move(cache)),
+        window_length_(window_length), window_type_(WindowType::kTGS), windows_(),
+        layers_(),
         thread_pool_(std::make_shared<thread_pool::ThreadPool>(num_threads)),
         logger_(new Logger()) {
 
@@ -180,6 +280,8 @@ Polisher::Polisher(std::unique_ptr<bioparser::Parser<Sequence>> sparser,
         alignment_engines_.emplace_back(spoa::AlignmentEngine::Create(
             spoa::AlignmentType::kNW, match, mismatch, gap));
         alignment_engines_.back()->Prealloc(window_length_, 5);
+        consensus_contexts_.emplace_back(createConsensusContext(match, mismatch,
+            gap, poa_band_width, agreement_threshold));
     }
 }
 
@@ -200,168 +302,577 @@ void Polisher::initialize() {
     tparser_->Reset();
     sequences_ = tparser_->Parse(-1);
 
-    uint64_t targets_size = sequences_.size();
-    if (targets_size == 0) {
+    targets_size_ = sequences_.size();
+    if (targets_size_ == 0) {
         fprintf(stderr, "[racon::Polisher::initialize] error: "
             "empty target sequences set!\n");
         exit(1);
     }
 
-    std::unordered_map<std::string, uint64_t> name_to_id;
-    std::unordered_map<uint64_t, uint64_t> id_to_id;
-    for (uint64_t i = 0; i < targets_size; ++i) {
-        name_to_id[sequences_[i]->name() + "t"] = i;
-        id_to_id[i << 1 | 1] = i;
+    // targets are packed in parallel while their names are indexed
+    std::vector<std::future<void>> thread_futures;
+    for (uint64_t i = 0; i < targets_size_; ++i) {
+        thread_futures.emplace_back(thread_pool_->Submit(
+            [&](uint64_t j) -> void {
+                sequences_[j]->transmute(true, true);
+            }, i));
+    }
+    for (uint64_t i = 0; i < targets_size_; ++i) {
+        name_index_->insert(sequences_[i]->name().c_str(),
+            sequences_[i]->name().size(), NameRole::kTarget, i);
+    }
+    for (const auto& it: thread_futures) {
+        it.wait();
     }
-
-    std::vector<bool> has_name(targets_size, true);
-    std::vector<bool> has_data(targets_size, true);
-    std::vector<bool> has_reverse_data(targets_size, false);
 
     logger_->log("[racon::Polisher::initialize] loaded target sequences");
     logger_->log();
 
-    uint64_t sequences_size = 0, total_sequences_length = 0;
+    // reads not referenced by any overlap to a target of this shard are
+    // dropped on arrival (always done when sharding), reads of SAM/BAM
+    // records are loaded while parsing overlaps instead
+    bool is_lazy = sparser_ != nullptr && (lazy_loading_ || num_shards_ > 1);
+
+    // a single pass over overlaps assigns targets to shards and finds reads
+    // which are used
+    uint64_t shard_begin = 0, shard_end = targets_size_;
+    std::vector<uint64_t> used_names;
+    std::vector<bool> used_ordinals;
+    if (num_shards_ > 1 || is_lazy) {
+        scan_targets(shard_begin, shard_end, is_lazy, used_names, used_ordinals);
+
+        logger_->log("[racon::Polisher::initialize] scanned overlaps");
+        logger_->log();
+    }
 
-    sparser_->Reset();
-    while (true) {
-        uint64_t l = sequences_.size();
-        auto reads = sparser_->Parse(kChunkSize);
-        if (reads.empty()) {
-          break;
+    if (sparser_ != nullptr) {
+
+        auto is_used_read = [&] (uint64_t ordinal, uint64_t hash) -> bool {
+            if (ordinal < used_ordinals.size() && used_ordinals[ordinal]) {
+                return true;
+            }
+            return std::binary_search(used_names.begin(), used_names.end(),
+                hash);
+        };
+
+        uint64_t sequences_size = 0, total_sequences_length = 0;
+
+        // reads are parsed on the thread pool one chunk ahead, while the current
+        // chunk is packed, validated and its names hashed in parallel, the
+        // hashes are inserted into the index afterwards
+        auto parse_reads = [&] () -> std::vector<std::unique_ptr<Sequence>> {
+            return sparser_->Parse(kChunkSize);
+        };
+
+        sparser_->Reset();
+        auto reads_future = thread_pool_->Submit(parse_reads);
+        while (true) {
+            auto reads = reads_future.get();
+            if (reads.empty()) {
+              break;
+            }
+            reads_future = thread_pool_->Submit(parse_reads);
+
+            // id of the target with the same name, targets_size_ if none or
+            // kUnusedRead if the read is dropped
+            std::vector<uint64_t> reads_to_targets(reads.size(), targets_size_);
+            std::vector<uint64_t> hashes(reads.size());
+            uint64_t reads_begin = sequences_size;
+
+            auto normalize_reads = [&] (uint64_t begin, uint64_t end) -> void {
+                for (uint64_t i = begin; i < end; ++i) {
+                    const auto& name = reads[i]->name();
+                    hashes[i] = hashName(name.c_str(), name.size());
+
+                    uint64_t id;
+                    if (!name_index_->find(name.c_str(), name.size(), hashes[i],
+                        NameRole::kTarget, id)) {
+                        if (is_lazy && !is_used_read(reads_begin + i, hashes[i])) {
+                            reads[i]->transmute(false, false);
+                            reads_to_targets[i] = kUnusedRead;
+                            continue;
+                        }
+                        reads[i]->transmute(true, true);
+                        continue;
+                    }
+                    if (reads[i]->length() != sequences_[id]->length() ||
+                        reads[i]->quality().size() != sequences_[id]->quality().size()) {
+
+                        fprintf(stderr, "[racon::Polisher::initialize] error: "
+                            "duplicate sequence %s with unequal data\n",
+                            reads[i]->name().c_str());
+                        exit(1);
+                    }
+                    reads_to_targets[i] = id;
+                }
+            };
+
+            uint64_t block_size = reads.size() / (4 * alignment_engines_.size()) + 1;
+            thread_futures.clear();
+            for (uint64_t i = 0; i < reads.size(); i += block_size) {
+                thread_futures.emplace_back(thread_pool_->Submit(normalize_reads, i,
+                    std::min(i + block_size, static_cast<uint64_t>(reads.size()))));
+            }
+            for (const auto& it: thread_futures) {
+                it.wait();
+            }
+
+            for (uint64_t i = 0; i < reads.size(); ++i, ++sequences_size) {
+                total_sequences_length += reads[i]->length();
+
+                uint64_t id = reads_to_targets[i];
+                if (id == kUnusedRead) {
+                    // the ordinal maps to an invalid id
+                    id_to_id_.emplace_back(id);
+                    continue;
+                }
+                if (id == targets_size_) {
+                    id = sequences_.size();
+                }
+                name_index_->insert(reads[i]->name().c_str(), reads[i]->name().size(),
+                    hashes[i], NameRole::kQuery, id);
+                id_to_id_.emplace_back(id);
+
+                if (id == sequences_.size()) {
+                    sequences_.emplace_back(std::move(reads[i]));
+                }
+            }
         }
-        sequences_.insert(
-            sequences_.end(),
-            std::make_move_iterator(reads.begin()),
-            std::make_move_iterator(reads.end()));
 
-        uint64_t n = 0;
-        for (uint64_t i = l; i < sequences_.size(); ++i, ++sequences_size) {
-            total_sequences_length += sequences_[i]->data().size();
+        if (sequences_size == 0) {
+            fprintf(stderr, "[racon::Polisher::initialize] error: "
+                "empty sequences set!\n");
+            exit(1);
+        }
+
+        window_type_ = static_cast<double>(total_sequences_length) /
+            sequences_size <= 1000 ? WindowType::kNGS : WindowType::kTGS;
+
+        logger_->log("[racon::Polisher::initialize] loaded sequences");
+        logger_->log();
+    }
+
+    targets_splits_.assign(1, shard_begin);
+    uint64_t split_length = 0;
+    for (uint64_t i = shard_begin; i < shard_end; ++i) {
+        split_length += sequences_[i]->length();
+        if (split_size_ != 0 && split_length >= split_size_) {
+            targets_splits_.emplace_back(i + 1);
+            split_length = 0;
+        }
+    }
+    if (targets_splits_.size() == 1 || targets_splits_.back() != shard_end) {
+        targets_splits_.emplace_back(shard_end);
+    }
+
+    targets_coverages_.resize(targets_size_, 0);
+
+    // overlaps sorted by target are parsed while polishing instead, unless
+    // their breaking points can be loaded from the cache
+    is_streaming_ = target_sorted_ && (cache_ == nullptr || !cache_->is_hit());
+    if (is_streaming_) {
+        return;
+    }
+
+    initialize_windows(targets_splits_[0], targets_splits_[1]);
+}
 
-            auto it = name_to_id.find(sequences_[i]->name() + "t");
-            if (it != name_to_id.end()) {
-                if (sequences_[i]->data().size() != sequences_[it->second]->data().size() ||
-                    sequences_[i]->quality().size() != sequences_[it->second]->quality().size()) {
+void Polisher::reset_overlaps() {
+    overlaps_ordinal_ = 0;
+    if (nparser_ != nullptr) {
+        nparser_->reset();
+    } else {
+        oparser_->Reset();
+    }
+}
 
+std::vector<std::unique_ptr<Overlap>> Polisher::parse_overlaps(uint64_t bytes) {
+    auto overlaps = nparser_ != nullptr ? nparser_->parse(bytes, thread_pool_) :
+        oparser_->Parse(bytes);
+    // shards are found before reads are loaded
+    if (sparser_ == nullptr && !targets_splits_.empty()) {
+        load_reads(overlaps);
+    }
+    return overlaps;
+}
+
+void Polisher::load_reads(std::vector<std::unique_ptr<Overlap>>& overlaps) {
+
+    // reads are registered on the first pass and found by ordinals afterwards
+    bool is_first_chunk = id_to_id_.empty();
+    uint64_t reads_begin = sequences_.size(), num_reads = 0,
+        total_reads_length = 0;
+
+    for (const auto& it: overlaps) {
+        auto read = it->release_query(overlaps_ordinal_++);
+        if (overlaps_ordinal_ <= id_to_id_.size()) {
+            continue;
+        }
+
+        uint64_t id = kUnusedRead, t_id;
+        if (read != nullptr && it->error() <= error_threshold_ &&
+            name_index_->find(it->t_name().c_str(), it->t_name().size(),
+                NameRole::kTarget, t_id) &&
+            t_id >= targets_splits_.front() && t_id < targets_splits_.back()) {
+
+            ++num_reads;
+            total_reads_length += read->length();
+            if (name_index_->find(read->name().c_str(), read->name().size(),
+                NameRole::kTarget, id)) {
+                if (read->length() != sequences_[id]->length()) {
                     fprintf(stderr, "[racon::Polisher::initialize] error: "
                         "duplicate sequence %s with unequal data\n",
-                        sequences_[i]->name().c_str());
+                        read->name().c_str());
                     exit(1);
                 }
-
-                name_to_id[sequences_[i]->name() + "q"] = it->second;
-                id_to_id[sequences_size << 1 | 0] = it->second;
-
-                sequences_[i].reset();
-                ++n;
             } else {
-                name_to_id[sequences_[i]->name() + "q"] = i - n;
-                id_to_id[sequences_size << 1 | 0] = i - n;
+                id = sequences_.size();
+                sequences_.emplace_back(std::move(read));
             }
         }
-
-        shrinkToFit(sequences_, l);
+        id_to_id_.emplace_back(id);
     }
 
-    if (sequences_size == 0) {
-        fprintf(stderr, "[racon::Polisher::initialize] error: "
-            "empty sequences set!\n");
-        exit(1);
+    std::vector<std::future<void>> thread_futures;
+    for (uint64_t i = reads_begin; i < sequences_.size(); ++i) {
+        thread_futures.emplace_back(thread_pool_->Submit(
+            [&](uint64_t j) -> void {
+                sequences_[j]->transmute(true, true);
+            }, i));
+    }
+    for (const auto& it: thread_futures) {
+        it.wait();
     }
 
-    has_name.resize(sequences_.size(), false);
-    has_data.resize(sequences_.size(), false);
-    has_reverse_data.resize(sequences_.size(), false);
-
-    WindowType window_type = static_cast<double>(total_sequences_length) /
-        sequences_size <= 1000 ? WindowType::kNGS : WindowType::kTGS;
+    // estimated from the first chunk as windows might be created right away
+    if (is_first_chunk && num_reads > 0) {
+        window_type_ = static_cast<double>(total_reads_length) / num_reads <=
+            1000 ? WindowType::kNGS : WindowType::kTGS;
+    }
+}
 
-    logger_->log("[racon::Polisher::initialize] loaded sequences");
-    logger_->log();
+void Polisher::scan_overlaps(const std::function<void(const Overlap&, uint64_t)>& visit,
+    const std::function<void()>& end_of_chunk) {
 
-    std::vector<std::unique_ptr<Overlap>> overlaps;
+    reset_overlaps();
+    while (true) {
+        auto overlaps = parse_overlaps(kChunkSize);
+        if (overlaps.empty()) {
+            break;
+        }
 
-    auto remove_invalid_overlaps = [&](uint64_t begin, uint64_t end) -> void {
-        for (uint64_t i = begin; i < end; ++i) {
-            if (overlaps[i] == nullptr) {
+        for (const auto& it: overlaps) {
+            if (!it->is_valid() || it->error() > error_threshold_) {
                 continue;
             }
-            if (overlaps[i]->error() > error_threshold_ ||
-                overlaps[i]->q_id() == overlaps[i]->t_id()) {
-                overlaps[i].reset();
+
+            uint64_t id = it->t_id();
+            if (it->t_name().empty() ? id >= targets_size_ :
+                !name_index_->find(it->t_name().c_str(), it->t_name().size(),
+                    NameRole::kTarget, id)) {
                 continue;
             }
-            if (type_ == PolisherType::kC) {
-                for (uint64_t j = i + 1; j < end; ++j) {
-                    if (overlaps[j] == nullptr) {
-                        continue;
-                    }
-                    if (overlaps[i]->length() >= overlaps[j]->length()) {
+
+            visit(*it, id);
+        }
+
+        end_of_chunk();
+    }
+}
+
+void Polisher::scan_targets(uint64_t& targets_begin, uint64_t& targets_end,
+    bool find_reads, std::vector<uint64_t>& names, std::vector<bool>& ordinals) {
+
+    // reads are collected along with their targets while the shard is not
+    // known yet, as (target id, hashed name) and (target id, ordinal)
+    bool is_sharded = num_shards_ > 1;
+    std::vector<uint64_t> coverages(targets_size_, 0);
+    std::vector<std::pair<uint64_t, uint64_t>> target_names, target_ordinals;
+
+    auto collect_read = [&] (const Overlap& overlap, uint64_t t_id) -> void {
+        if (!overlap.q_name().empty()) {
+            uint64_t hash = hashName(overlap.q_name().c_str(),
+                overlap.q_name().size());
+            if (is_sharded) {
+                target_names.emplace_back(t_id, hash);
+            } else {
+                names.emplace_back(hash);
+            }
+        } else if (is_sharded) {
+            target_ordinals.emplace_back(t_id, overlap.q_id());
+        } else {
+            if (overlap.q_id() >= ordinals.size()) {
+                ordinals.resize(static_cast<uint64_t>(overlap.q_id()) + 1, false);
+            }
+            ordinals[overlap.q_id()] = true;
+        }
+    };
+
+    scan_overlaps([&] (const Overlap& overlap, uint64_t t_id) -> void {
+        ++coverages[t_id];
+        if (find_reads && t_id >= targets_begin && t_id < targets_end) {
+            collect_read(overlap, t_id);
+        }
+    }, [&] () -> void {
+        // hash collisions only keep a few surplus reads
+        std::sort(names.begin(), names.end());
+        names.erase(std::unique(names.begin(), names.end()), names.end());
+        std::sort(target_names.begin(), target_names.end());
+        target_names.erase(std::unique(target_names.begin(), target_names.end()),
+            target_names.end());
+        std::sort(target_ordinals.begin(), target_ordinals.end());
+        target_ordinals.erase(std::unique(target_ordinals.begin(),
+            target_ordinals.end()), target_ordinals.end());
+    });
+
+    if (!is_sharded) {
+        return;
+    }
+
+    find_shard(coverages, targets_begin, targets_end);
+
+    for (const auto& it: target_names) {
+        if (it.first >= targets_begin && it.first < targets_end) {
+            names.emplace_back(it.second);
+        }
+    }
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+
+    for (const auto& it: target_ordinals) {
+        if (it.first >= targets_begin && it.first < targets_end) {
+            if (it.second >= ordinals.size()) {
+                ordinals.resize(it.second + 1, false);
+            }
+            ordinals[it.second] = true;
+        }
+    }
+}
+
+void Polisher::find_shard(const std::vector<uint64_t>& coverages,
+    uint64_t& targets_begin, uint64_t& targets_end) const {
+
+    // shards are contiguous ranges of targets so that concatenated outputs
+    // keep the order of targets, a target belongs to the shard containing
+    // the midpoint of its weight (length times coverage)
+    std::vector<double> weights(targets_size_);
+    double total_weight = 0;
+    for (uint64_t i = 0; i < targets_size_; ++i) {
+        weights[i] = static_cast<double>(sequences_[i]->length()) *
+            std::max(coverages[i], static_cast<uint64_t>(1));
+        total_weight += weights[i];
+    }
+
+    targets_begin = targets_size_;
+    targets_end = targets_size_;
+    double weight = 0;
+    for (uint64_t i = 0; i < targets_size_; ++i) {
+        uint64_t shard = std::min(static_cast<uint64_t>(num_shards_ *
+            (weight + weights[i] / 2) / total_weight),
+            static_cast<uint64_t>(num_shards_ - 1));
+        weight += weights[i];
+
+        if (shard == shard_ && targets_begin == targets_size_) {
+            targets_begin = i;
+        } else if (shard > shard_) {
+            targets_end = i;
+            break;
+        }
+    }
+    if (targets_begin == targets_size_) {
+        targets_end = targets_size_;
+    }
+}
+
+void Polisher::transmute_overlaps(std::vector<std::unique_ptr<Overlap>>& overlaps,
+    uint64_t begin) {
+
+    if (overlaps.size() <= begin) {
+        return;
+    }
+
+    uint64_t block_size = (overlaps.size() - begin + thread_pool_->num_threads() - 1) /
+        thread_pool_->num_threads();
+
+    std::vector<std::future<void>> thread_futures;
+    for (uint64_t i = begin; i < overlaps.size(); i += block_size) {
+        thread_futures.emplace_back(thread_pool_->Submit(
+            [&](uint64_t first, uint64_t last) -> void {
+                for (uint64_t j = first; j < last; ++j) {
+                    overlaps[j]->transmute(sequences_, *name_index_, id_to_id_,
+                        targets_size_);
+                    if (!overlaps[j]->is_valid() ||
+                        overlaps[j]->error() > error_threshold_ ||
+                        overlaps[j]->q_id() == overlaps[j]->t_id()) {
                         overlaps[j].reset();
-                    } else {
-                        overlaps[i].reset();
-                        break;
                     }
                 }
-            }
+            }, i, std::min(i + block_size, static_cast<uint64_t>(overlaps.size()))));
+    }
+    for (const auto& it: thread_futures) {
+        it.wait();
+    }
+}
+
+void Polisher::rank_overlaps(std::vector<std::unique_ptr<Overlap>>& overlaps,
+    uint64_t begin, uint64_t offset, std::vector<OverlapRank>& ranks) {
+
+    if (overlaps.size() <= begin) {
+        return;
+    }
+
+    uint64_t num_partitions = thread_pool_->num_threads();
+    uint64_t block_size = (overlaps.size() - begin + num_partitions - 1) /
+        num_partitions;
+    uint64_t num_blocks = (overlaps.size() - begin + block_size - 1) / block_size;
+
+    // buckets[i][j] holds overlaps of block i whose reads belong to partition j
+    std::vector<std::vector<std::vector<uint64_t>>> buckets(num_blocks,
+        std::vector<std::vector<uint64_t>>(num_partitions));
+
+    std::vector<std::future<void>> thread_futures;
+    for (uint64_t i = 0; i < num_blocks; ++i) {
+        thread_futures.emplace_back(thread_pool_->Submit(
+            [&](uint64_t k) -> void {
+                uint64_t first = begin + k * block_size;
+                uint64_t last = std::min(first + block_size,
+                    static_cast<uint64_t>(overlaps.size()));
+                for (uint64_t j = first; j < last; ++j) {
+                    if (overlaps[j] != nullptr) {
+                        buckets[k][overlaps[j]->q_id() % num_partitions].emplace_back(j);
+                    }
+                }
+            }, i));
+    }
+    for (const auto& it: thread_futures) {
+        it.wait();
+    }
+    thread_futures.clear();
+
+    // each read is updated by a single thread
+    for (uint64_t i = 0; i < num_partitions; ++i) {
+        thread_futures.emplace_back(thread_pool_->Submit(
+            [&](uint64_t k) -> void {
+                for (const auto& block: buckets) {
+                    for (const auto& j: block[k]) {
+                        auto& rank = ranks[overlaps[j]->q_id()];
+                        if (!isBetterOverlap(*overlaps[j], j + offset, rank)) {
+                            overlaps[j].reset();
+                            continue;
+                        }
+                        if (rank.ordinal != kNoOverlap && rank.ordinal >= offset) {
+                            overlaps[rank.ordinal - offset].reset();
+                        }
+                        rank = { j + offset, overlaps[j]->t_id(),
+                            overlaps[j]->length(), overlaps[j]->strand(),
+                            overlaps[j]->error() };
+                    }
+                }
+            }, i));
+    }
+    for (const auto& it: thread_futures) {
+        it.wait();
+    }
+}
+
+void Polisher::initialize_windows(uint64_t targets_begin, uint64_t targets_end) {
+
+    // reads have to outlive all but the last split
+    bool is_last_split = targets_end == targets_splits_.back();
+
+    // targets of other shards keep their data only if used as reads
+    std::vector<bool> has_name(sequences_.size(), false);
+    std::vector<bool> has_data(sequences_.size(), !is_last_split);
+    for (uint64_t i = 0; i < targets_size_; ++i) {
+        has_name[i] = true;
+        if (i >= targets_splits_.front() && i < targets_splits_.back()) {
+            has_data[i] = true;
         }
-    };
+    }
 
-    oparser_->Reset();
-    uint64_t c = 0;
-    while (true) {
-        auto overlaps_chunk = oparser_->Parse(kChunkSize);
-        if (overlaps_chunk.empty()) {
-          break;
+    std::vector<std::unique_ptr<Overlap>> overlaps;
+
+    // the automatic maximum depth is derived from all targets of the shard
+    // while loading the first split
+    bool is_depth_unknown = max_depth_ < 0;
+    std::vector<uint64_t> targets_bases(is_depth_unknown ? targets_size_ : 0, 0);
+
+    bool is_cached = cache_ != nullptr && cache_->is_hit();
+    if (is_cached) {
+        cache_->load(targets_begin, targets_end, overlaps,
+            is_depth_unknown ? &targets_bases : nullptr);
+    } else {
+        std::vector<OverlapRank> ranks;
+        if (type_ == PolisherType::kC) {
+            ranks.resize(sequences_.size(), { kNoOverlap, 0, 0, 0, 0 });
         }
-        overlaps.insert(
-            overlaps.end(),
-            std::make_move_iterator(overlaps_chunk.begin()),
-            std::make_move_iterator(overlaps_chunk.end()));
 
-        uint64_t l = c;
-        for (uint64_t i = l; i < overlaps.size(); ++i) {
-            overlaps[i]->transmute(sequences_, name_to_id, id_to_id);
+        reset_overlaps();
+        while (true) {
+            auto overlaps_chunk = parse_overlaps(kChunkSize);
+            if (overlaps_chunk.empty()) {
+                break;
+            }
 
-            if (!overlaps[i]->is_valid()) {
-                overlaps[i].reset();
-                continue;
+            uint64_t l = overlaps.size();
+            overlaps.insert(
+                overlaps.end(),
+                std::make_move_iterator(overlaps_chunk.begin()),
+                std::make_move_iterator(overlaps_chunk.end()));
+
+            transmute_overlaps(overlaps, l);
+            shrinkToFit(overlaps, l);
+
+            if (is_depth_unknown && type_ == PolisherType::kF) {
+                for (uint64_t i = l; i < overlaps.size(); ++i) {
+                    targets_bases[overlaps[i]->t_id()] += overlaps[i]->length();
+                }
             }
 
-            while (overlaps[c] == nullptr) {
-                ++c;
+            // ordinals are indices which is why overlaps are compacted only
+            // at the end
+            if (type_ == PolisherType::kC) {
+                ranks.resize(sequences_.size(), { kNoOverlap, 0, 0, 0, 0 });
+                rank_overlaps(overlaps, l, 0, ranks);
             }
-            if (overlaps[c]->q_id() != overlaps[i]->q_id()) {
-                remove_invalid_overlaps(c, i);
-                c = i;
+
+            // overlaps are filtered by split only after they are ranked so
+            // that splitting does not change the outcome
+            for (uint64_t i = l; i < overlaps.size(); ++i) {
+                if (overlaps[i] != nullptr && (overlaps[i]->t_id() < targets_begin ||
+                    overlaps[i]->t_id() >= targets_end)) {
+                    overlaps[i].reset();
+                }
             }
         }
+        shrinkToFit(overlaps, 0);
 
-        uint64_t n = 0;
-        for (uint64_t i = l; i < c; ++i) {
-          if (overlaps[i] == nullptr) {
-            ++n;
-          }
+        if (is_depth_unknown && type_ == PolisherType::kC) {
+            for (const auto& it: ranks) {
+                if (it.ordinal != kNoOverlap) {
+                    targets_bases[it.t_id] += it.length;
+                }
+            }
         }
-        c -= n;
-        shrinkToFit(overlaps, l);
     }
-    remove_invalid_overlaps(c, overlaps.size());
-    shrinkToFit(overlaps, c);
 
+    if (is_depth_unknown) {
+        find_max_depth(targets_bases);
+    }
+
+    // reads of SAM/BAM records are loaded along with overlaps
+    has_name.resize(sequences_.size(), false);
+    has_data.resize(sequences_.size(), !is_last_split);
     for (const auto& it : overlaps) {
-        if (it->strand()) {
-            has_reverse_data[it->q_id()] = true;
-        } else {
-            has_data[it->q_id()] = true;
-        }
+        has_data[it->q_id()] = true;
     }
 
-    std::unordered_map<std::string, uint64_t>().swap(name_to_id);
-    std::unordered_map<uint64_t, uint64_t>().swap(id_to_id);
+    if (is_last_split) {
+        name_index_->clear();
+        std::vector<uint64_t>().swap(id_to_id_);
+    }
 
-    if (overlaps.empty()) {
+    if (overlaps.empty() && targets_splits_.size() == 2 && num_shards_ < 2) {
         fprintf(stderr, "[racon::Polisher::initialize] error: "
             "empty overlap set!\n");
         exit(1);
@@ -374,35 +885,54 @@ void Polisher::initialize() {
     for (uint64_t i = 0; i < sequences_.size(); ++i) {
         thread_futures.emplace_back(thread_pool_->Submit(
             [&](uint64_t j) -> void {
-                sequences_[j]->transmute(has_name[j], has_data[j], has_reverse_data[j]);
+                sequences_[j]->transmute(has_name[j], has_data[j]);
             }, i));
     }
     for (const auto& it: thread_futures) {
         it.wait();
     }
 
-    find_overlap_breaking_points(overlaps);
+    if (is_cached) {
+        logger_->log("[racon::Polisher::initialize] loaded breaking points from cache");
+    } else {
+        find_overlap_breaking_points(overlaps);
+
+        if (cache_ != nullptr) {
+            cache_->store(overlaps);
+            if (is_last_split) {
+                cache_->close();
+            }
+        }
+    }
 
     logger_->log();
 
-    std::vector<uint64_t> id_to_first_window_id(targets_size + 1, 0);
-    for (uint64_t i = 0; i < targets_size; ++i) {
-        uint32_t k = 0;
-        for (uint32_t j = 0; j < sequences_[i]->data().size(); j += window_length_, ++k) {
+    std::vector<uint64_t> targets;
+    for (uint64_t i = targets_begin; i < targets_end; ++i) {
+        targets.emplace_back(i);
+    }
+    create_windows(overlaps, targets);
 
-            uint32_t length = std::min(j + window_length_,
-                static_cast<uint32_t>(sequences_[i]->data().size())) - j;
+    logger_->log("[racon::Polisher::initialize] transformed data into windows");
+}
 
-            windows_.emplace_back(createWindow(i, k, window_type,
-                &(sequences_[i]->data()[j]), length,
-                sequences_[i]->quality().empty() ? &(dummy_quality_[0]) :
-                &(sequences_[i]->quality()[j]), length));
-        }
+void Polisher::create_windows(std::vector<std::unique_ptr<Overlap>>& overlaps,
+    const std::vector<uint64_t>& targets) {
 
-        id_to_first_window_id[i + 1] = id_to_first_window_id[i] + k;
+    std::vector<uint64_t> id_to_first_window_id(targets_size_, 0);
+    uint64_t num_windows = 0;
+    for (const auto& it: targets) {
+        id_to_first_window_id[it] = num_windows;
+        num_windows += (sequences_[it]->length() +
+            static_cast<uint64_t>(window_length_) - 1) / window_length_;
     }
 
-    targets_coverages_.resize(targets_size, 0);
+    // layers are collected in overlap order, counted per window and then
+    // scattered into layers_ so that those of a window are contiguous (and
+    // keep their order), the backbone is the first layer of each window
+    std::vector<Layer> layers;
+    std::vector<uint64_t> layers_window_ids;
+    std::vector<uint64_t> offsets(num_windows + 1, 0);
 
     for (uint64_t i = 0; i < overlaps.size(); ++i) {
 
@@ -416,61 +946,148 @@ void Polisher::initialize() {
                 continue;
             }
 
-            if (!sequence->quality().empty() ||
-                !sequence->reverse_quality().empty()) {
+            // layers are ranked by the identity of their overlap, the part
+            // of the window they span and the expected accuracy of their bases
+            double score = 1 - overlaps[i]->error();
 
-                const auto& quality = overlaps[i]->strand() ?
-                    sequence->reverse_quality() : sequence->quality();
+            if (!sequence->quality().empty()) {
+                // qualities of the reverse strand are read backwards
+                const auto& quality = sequence->quality();
+                uint32_t offset = overlaps[i]->strand() ? sequence->length() - 1 : 0;
                 double average_quality = 0;
                 for (uint32_t k = breaking_points[j].second; k < breaking_points[j + 1].second; ++k) {
-                    average_quality += static_cast<uint32_t>(quality[k]) - 33;
+                    average_quality += static_cast<uint32_t>(quality[
+                        overlaps[i]->strand() ? offset - k : k]) - 33;
                 }
                 average_quality /= breaking_points[j + 1].second - breaking_points[j].second;
 
                 if (average_quality < quality_threshold_) {
                     continue;
                 }
+                score *= 1 - std::pow(10, -average_quality / 10);
             }
 
             uint64_t window_id = id_to_first_window_id[overlaps[i]->t_id()] +
                 breaking_points[j].first / window_length_;
             uint32_t window_start = (breaking_points[j].first / window_length_) *
                 window_length_;
+            uint32_t window_end = std::min(window_start + window_length_,
+                sequences_[overlaps[i]->t_id()]->length());
+            score *= (breaking_points[j + 1].first - breaking_points[j].first) /
+                static_cast<double>(window_end - window_start);
+
+            uint32_t length = breaking_points[j + 1].second - breaking_points[j].second;
+            uint32_t begin = breaking_points[j].first - window_start;
+            uint32_t end = breaking_points[j + 1].first - window_start - 1;
+            if (length == 0 || begin == end) {
+                continue;
+            }
 
-            const char* data = overlaps[i]->strand() ?
-                &(sequence->reverse_complement()[breaking_points[j].second]) :
-                &(sequence->data()[breaking_points[j].second]);
-            uint32_t data_length = breaking_points[j + 1].second -
-                breaking_points[j].second;
+            layers.push_back({sequence.get(), overlaps[i]->strand(),
+                breaking_points[j].second, length, begin, end,
+                static_cast<float>(score)});
+            layers_window_ids.emplace_back(window_id);
+            ++offsets[window_id + 1];
+        }
 
-            const char* quality = overlaps[i]->strand() ?
-                (sequence->reverse_quality().empty() ?
-                    nullptr : &(sequence->reverse_quality()[breaking_points[j].second]))
-                :
-                (sequence->quality().empty() ?
-                    nullptr : &(sequence->quality()[breaking_points[j].second]));
-            uint32_t quality_length = quality == nullptr ? 0 : data_length;
+        overlaps[i].reset();
+    }
+
+    // offsets[i] is the first layer of window i (reserved for its backbone)
+    for (uint64_t i = 0; i < num_windows; ++i) {
+        offsets[i + 1] += offsets[i] + 1;
+    }
+
+    layers_.resize(offsets[num_windows]);
+    for (uint64_t i = 0; i < layers.size(); ++i) {
+        layers_[++offsets[layers_window_ids[i]]] = layers[i];
+    }
+    std::vector<Layer>().swap(layers);
+    std::vector<uint64_t>().swap(layers_window_ids);
 
-            windows_[window_id]->add_layer(data, data_length,
-                quality, quality_length,
-                breaking_points[j].first - window_start,
-                breaking_points[j + 1].first - window_start - 1);
+    // offsets[i] is now the last layer of window i
+    windows_.reserve(num_windows);
+    uint64_t begin = 0;
+    for (const auto& i: targets) {
+        uint32_t k = 0;
+        for (uint32_t j = 0; j < sequences_[i]->length(); j += window_length_, ++k) {
+
+            uint32_t length = std::min(j + window_length_,
+                sequences_[i]->length()) - j;
+            layers_[begin] = {sequences_[i].get(), 0, j, length, 0, 0, 0};
+
+            uint64_t end = offsets[id_to_first_window_id[i] + k] + 1;
+            windows_.emplace_back(createWindow(i, k, window_type_,
+                &layers_[begin], end - begin));
+            begin = end;
         }
+    }
 
-        overlaps[i].reset();
+    if (max_depth_ <= 0) {
+        return;
     }
 
-    logger_->log("[racon::Polisher::initialize] transformed data into windows");
+    for (auto& it: windows_) {
+        it.reduce_layers(max_depth_);
+    }
+}
+
+void Polisher::find_max_depth(const std::vector<uint64_t>& targets_bases) {
+
+    // coverage of a target is the total length of its overlaps divided by
+    // its length, targets without overlaps are not counted
+    std::vector<uint32_t> coverages;
+    for (uint64_t i = targets_splits_.front(); i < targets_splits_.back(); ++i) {
+        if (targets_bases[i] != 0) {
+            coverages.emplace_back(targets_bases[i] / sequences_[i]->length());
+        }
+    }
+
+    max_depth_ = kMinAutoDepth;
+    if (!coverages.empty()) {
+        std::nth_element(coverages.begin(), coverages.begin() +
+            coverages.size() / 2, coverages.end());
+        max_depth_ = std::max(kMinAutoDepth,
+            kAutoDepthFactor * coverages[coverages.size() / 2]);
+    }
 }
 
 void Polisher::find_overlap_breaking_points(std::vector<std::unique_ptr<Overlap>>& overlaps)
 {
-    std::vector<std::future<void>> thread_futures;
+    // splits, shards and the last batch of streaming can be left without
+    // overlaps
+    if (overlaps.empty()) {
+        return;
+    }
+
+    // in fragment correction both A to B and B to A usually exist, only one
+    // of them is aligned and breaking points of the other are derived from it
+    std::vector<uint64_t> duals(overlaps.size(), kNoDual);
+    if (type_ == PolisherType::kF) {
+        find_dual_overlaps(overlaps, duals);
+    }
+
+    // longest overlaps are aligned first so that they do not hold back the
+    // end of this stage
+    std::vector<uint64_t> order;
+    order.reserve(overlaps.size());
     for (uint64_t i = 0; i < overlaps.size(); ++i) {
+        if (duals[i] == kNoDual || duals[i] > i) {
+            order.emplace_back(i);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(), [&] (uint64_t lhs, uint64_t rhs) -> bool {
+        return overlaps[lhs]->length() > overlaps[rhs]->length();
+    });
+
+    std::vector<std::future<void>> thread_futures;
+    for (const auto& it: order) {
         thread_futures.emplace_back(thread_pool_->Submit(
             [&](uint64_t j) -> void {
-                overlaps[j]->find_breaking_points(sequences_, window_length_);
-            }, i));
+                overlaps[j]->find_breaking_points(sequences_, window_length_,
+                    error_threshold_, duals[j] == kNoDual ? nullptr :
+                    overlaps[duals[j]].get());
+            }, it));
     }
 
     uint32_t logger_step = thread_futures.size() / 20;
@@ -487,23 +1104,255 @@ void Polisher::find_overlap_breaking_points(std::vector<std::unique_ptr<Overlap>
     }
 }
 
+void Polisher::find_dual_overlaps(
+    const std::vector<std::unique_ptr<Overlap>>& overlaps,
+    std::vector<uint64_t>& duals) const {
+
+    // overlaps are grouped by their (unordered) pair of sequences, groups
+    // rarely hold more than two overlaps
+    std::vector<std::pair<std::pair<uint64_t, uint64_t>, uint64_t>> keys;
+    keys.reserve(overlaps.size());
+    for (uint64_t i = 0; i < overlaps.size(); ++i) {
+        uint64_t q_id = overlaps[i]->q_id(), t_id = overlaps[i]->t_id();
+        keys.emplace_back(std::make_pair(std::min(q_id, t_id),
+            std::max(q_id, t_id)), i);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    for (uint64_t i = 0, j = 0; i < keys.size(); i = j) {
+        j = i + 1;
+        while (j < keys.size() && keys[j].first == keys[i].first) {
+            ++j;
+        }
+
+        for (uint64_t k = i; k < j; ++k) {
+            uint64_t lhs = keys[k].second;
+            for (uint64_t l = k + 1; l < j && duals[lhs] == kNoDual; ++l) {
+                uint64_t rhs = keys[l].second;
+                if (duals[rhs] == kNoDual && overlaps[lhs]->is_dual(*overlaps[rhs])) {
+                    duals[lhs] = rhs;
+                    duals[rhs] = lhs;
+                }
+            }
+        }
+    }
+}
+
 void Polisher::polish(std::vector<std::unique_ptr<Sequence>>& dst,
     bool drop_unpolished_sequences) {
 
+    polish([&dst] (std::unique_ptr<Sequence> sequence) -> void {
+        dst.emplace_back(std::move(sequence));
+    }, drop_unpolished_sequences);
+}
+
+void Polisher::polish(const SequenceSink& sink, bool drop_unpolished_sequences) {
+
+    if (is_streaming_) {
+        polish_streaming(sink, drop_unpolished_sequences);
+        std::vector<std::unique_ptr<Sequence>>().swap(sequences_);
+        return;
+    }
+
+    for (uint64_t i = 1; i < targets_splits_.size(); ++i) {
+        if (i != 1) {
+            logger_->log();
+            initialize_windows(targets_splits_[i - 1], targets_splits_[i]);
+        }
+        polish_windows(sink, drop_unpolished_sequences);
+    }
+
+    std::vector<std::unique_ptr<Sequence>>().swap(sequences_);
+}
+
+void Polisher::polish_streaming(const SequenceSink& sink,
+    bool drop_unpolished_sequences) {
+
+    uint64_t targets_begin = targets_splits_.front();
+    uint64_t targets_end = targets_splits_.back();
+
+    // the best overlap of each read and the automatic maximum depth are
+    // known only after all overlaps are parsed, ordinals are positions in the
+    // overlap file
+    std::vector<OverlapRank> ranks;
+    bool is_depth_unknown = max_depth_ < 0;
+    if (type_ == PolisherType::kC || is_depth_unknown) {
+        std::vector<uint64_t> targets_bases(is_depth_unknown ? targets_size_ : 0, 0);
+
+        reset_overlaps();
+        uint64_t offset = 0;
+        while (true) {
+            auto overlaps_chunk = parse_overlaps(kStreamChunkSize);
+            if (overlaps_chunk.empty()) {
+                break;
+            }
+            transmute_overlaps(overlaps_chunk, 0);
+            if (type_ == PolisherType::kC) {
+                ranks.resize(sequences_.size(), { kNoOverlap, 0, 0, 0, 0 });
+                rank_overlaps(overlaps_chunk, 0, offset, ranks);
+            } else {
+                for (const auto& it: overlaps_chunk) {
+                    if (it != nullptr) {
+                        targets_bases[it->t_id()] += it->length();
+                    }
+                }
+            }
+            offset += overlaps_chunk.size();
+        }
+
+        if (is_depth_unknown) {
+            for (const auto& it: ranks) {
+                if (it.ordinal != kNoOverlap) {
+                    targets_bases[it.t_id] += it.length;
+                }
+            }
+            find_max_depth(targets_bases);
+        }
+
+        logger_->log(type_ == PolisherType::kC ?
+            "[racon::Polisher::polish] ranked overlaps" :
+            "[racon::Polisher::polish] scanned overlaps");
+    }
+
+    // targets are complete once their group of overlaps ends, groups can
+    // come in any order (e.g. PAF sorted by target name) but a target may
+    // not appear again once complete
+    const uint64_t kNoTarget = -1;
+    std::vector<bool> is_complete(targets_size_, false);
+    uint64_t current_target = kNoTarget, num_overlaps = 0;
+
+    // complete targets of this shard which are not polished yet (in the order
+    // of their groups) and their filtered overlaps followed by those of
+    // current_target
+    std::vector<uint64_t> targets;
+    std::vector<std::unique_ptr<Overlap>> pending;
+
+    // polishes targets with their pending overlaps
+    auto polish_targets = [&] () -> void {
+        uint64_t n = pending.size();
+        while (n > 0 && pending[n - 1]->t_id() == current_target) {
+            --n;
+        }
+        std::vector<std::unique_ptr<Overlap>> batch(
+            std::make_move_iterator(pending.begin()),
+            std::make_move_iterator(pending.begin() + n));
+        pending.erase(pending.begin(), pending.begin() + n);
+        num_overlaps += batch.size();
+
+        logger_->log();
+        find_overlap_breaking_points(batch);
+        if (cache_ != nullptr) {
+            cache_->store(batch);
+        }
+        create_windows(batch, targets);
+        polish_windows(sink, drop_unpolished_sequences);
+
+        targets.clear();
+    };
+
+    auto complete_target = [&] (uint64_t t_id) -> void {
+        is_complete[t_id] = true;
+        if (t_id >= targets_begin && t_id < targets_end) {
+            targets.emplace_back(t_id);
+        }
+    };
+
+    reset_overlaps();
+    uint64_t offset = 0;
+    while (true) {
+        auto overlaps_chunk = parse_overlaps(kStreamChunkSize);
+        transmute_overlaps(overlaps_chunk, 0);
+
+        for (uint64_t i = 0; i < overlaps_chunk.size(); ++i) {
+            auto& it = overlaps_chunk[i];
+            if (it == nullptr) {
+                continue;
+            }
+            if (it->t_id() != current_target) {
+                if (is_complete[it->t_id()]) {
+                    fprintf(stderr, "[racon::Polisher::polish] error: "
+                        "overlaps are not grouped by target!\n");
+                    exit(1);
+                }
+                if (current_target != kNoTarget) {
+                    complete_target(current_target);
+                }
+                current_target = it->t_id();
+            }
+
+            if ((type_ == PolisherType::kC && ranks[it->q_id()].ordinal != i + offset) ||
+                it->t_id() < targets_begin || it->t_id() >= targets_end) {
+                continue;
+            }
+            pending.emplace_back(std::move(it));
+        }
+        offset += overlaps_chunk.size();
+
+        if (overlaps_chunk.empty()) {
+            // the last group and targets without overlaps (in target order)
+            if (current_target != kNoTarget) {
+                complete_target(current_target);
+                current_target = kNoTarget;
+            }
+            for (uint64_t i = targets_begin; i < targets_end; ++i) {
+                if (!is_complete[i]) {
+                    targets.emplace_back(i);
+                }
+            }
+            polish_targets();
+            break;
+        }
+
+        if (!targets.empty()) {
+            polish_targets();
+        }
+    }
+
+    name_index_->clear();
+    std::vector<uint64_t>().swap(id_to_id_);
+    if (cache_ != nullptr) {
+        cache_->close();
+    }
+
+    if (num_overlaps == 0 && num_shards_ < 2) {
+        fprintf(stderr, "[racon::Polisher::polish] error: "
+            "empty overlap set!\n");
+        exit(1);
+    }
+}
+
+void Polisher::polish_windows(const SequenceSink& sink,
+    bool drop_unpolished_sequences) {
+
     logger_->log();
 
-    std::vector<std::future<bool>> thread_futures;
+    // windows are submitted from the most expensive one so that a few deep
+    // windows do not keep a single worker busy at the end, their results are
+    // still collected in order (futures serve as a reorder buffer)
+    std::vector<uint64_t> costs(windows_.size());
+    std::vector<uint64_t> order(windows_.size());
     for (uint64_t i = 0; i < windows_.size(); ++i) {
-        thread_futures.emplace_back(thread_pool_->Submit(
+        costs[i] = windows_[i].cost();
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&] (uint64_t lhs, uint64_t rhs) {
+        return costs[lhs] > costs[rhs]; });
+
+    std::vector<std::future<bool>> thread_futures(windows_.size());
+    for (const auto& i: order) {
+        thread_futures[i] = thread_pool_->Submit(
             [&](uint64_t j) -> bool {
                 auto it = thread_pool_->thread_map().find(std::this_thread::get_id());  // NOLINT
-                return windows_[j]->generate_consensus(
-                    alignment_engines_[it->second], trim_);
-            }, i));
+                return windows_[j].generate_consensus(
+                    alignment_engines_[it->second],
+                    consensus_contexts_[it->second], trim_);
+            }, i);
     }
 
     std::string polished_data = "";
     uint32_t num_polished_windows = 0;
+    // windows left unchanged as their layers agree with the backbone
+    uint64_t num_kept_windows = 0;
 
     uint64_t logger_step = thread_futures.size() / 20;
 
@@ -511,25 +1360,26 @@ void Polisher::polish(std::vector<std::unique_ptr<Sequence>>& dst,
         thread_futures[i].wait();
 
         num_polished_windows += thread_futures[i].get() == true ? 1 : 0;
-        polished_data += windows_[i]->consensus();
+        num_kept_windows += windows_[i].is_backbone_kept() ? 1 : 0;
+        polished_data += windows_[i].consensus();
 
-        if (i == windows_.size() - 1 || windows_[i + 1]->rank() == 0) {
+        if (i == windows_.size() - 1 || windows_[i + 1].rank() == 0) {
             double polished_ratio = num_polished_windows /
-                static_cast<double>(windows_[i]->rank() + 1);
+                static_cast<double>(windows_[i].rank() + 1);
 
             if (!drop_unpolished_sequences || polished_ratio > 0) {
                 std::string tags = type_ == PolisherType::kF ? "r" : "";
                 tags += " LN:i:" + std::to_string(polished_data.size());
-                tags += " RC:i:" + std::to_string(targets_coverages_[windows_[i]->id()]);
+                tags += " RC:i:" + std::to_string(targets_coverages_[windows_[i].id()]);
                 tags += " XC:f:" + std::to_string(polished_ratio);
-                dst.emplace_back(createSequence(sequences_[windows_[i]->id()]->name() +
+                sink(createSequence(sequences_[windows_[i].id()]->name() +
                     tags, polished_data));
             }
 
             num_polished_windows = 0;
             polished_data.clear();
         }
-        windows_[i].reset();
+        windows_[i].clear_consensus();
 
         if (logger_step != 0 && (i + 1) % logger_step == 0 && (i + 1) / logger_step < 20) {
             logger_->bar("[racon::Polisher::polish] generating consensus");
@@ -541,9 +1391,13 @@ void Polisher::polish(std::vector<std::unique_ptr<Sequence>>& dst,
     } else {
         logger_->log("[racon::Polisher::polish] generated consensus");
     }
+    if (num_kept_windows != 0) {
+        logger_->log("[racon::Polisher::polish] kept backbones of " +
+            std::to_string(num_kept_windows) + " windows");
+    }
 
-    std::vector<std::shared_ptr<Window>>().swap(windows_);
-    std::vector<std::unique_ptr<Sequence>>().swap(sequences_);
+    std::vector<Window>().swap(windows_);
+    std::vector<Layer>().swap(layers_);
 }
 
 }
@@ -9,8 +9,10 @@
 #include <stdlib.h>
 #include <vector>
 #include <memory>
-#include <unordered_map>
 #include <thread>
+#include <functional>
+
+#include "window.hpp"
 
 namespace bioparser {
     template<class T>
@@ -30,14 +32,21 @@ namespace racon {
 
 class Sequence;
 class Overlap;
-class Window;
+class OverlapParser;
 class Logger;
+class OverlapCache;
+class NameIndex;
+struct OverlapRank;
 
 enum class PolisherType {
     kC, // Contig polishing
     kF // Fragment error correction
 };
 
+// receives polished sequences in target order (in the order of groups of
+// overlaps with --target-sorted)
+using SequenceSink = std::function<void(std::unique_ptr<Sequence>)>;
+
 class Polisher;
 std::unique_ptr<Polisher> createPolisher(const std::string& sequences_path,
     const std::string& overlaps_path, const std::string& target_path,
@@ -45,7 +54,11 @@ std::unique_ptr<Polisher> createPolisher(const std::string& sequences_path,
     double error_threshold, bool trim, int8_t match, int8_t mismatch, int8_t gap,
     uint32_t num_threads, uint32_t cuda_batches = 0,
     bool cuda_banded_alignment = false, uint32_t cudaaligner_batches = 0,
-    uint32_t cudaaligner_band_width = 0);
+    uint32_t cudaaligner_band_width = 0, uint64_t split_size = 0,
+    const std::string& cache_path = "", bool lazy_loading = false,
+    uint32_t shard = 0, uint32_t num_shards = 1, bool target_sorted = false,
+    int32_t max_depth = 0, uint32_t poa_band_width = 0,
+    double agreement_threshold = 0);
 
 class Polisher {
 public:
@@ -56,26 +69,111 @@ public:
     virtual void polish(std::vector<std::unique_ptr<Sequence>>& dst,
         bool drop_unpolished_sequences);
 
+    /*!
+     * @brief Passes each polished sequence to sink as soon as all of its
+     * windows are done
+     */
+    virtual void polish(const SequenceSink& sink,
+        bool drop_unpolished_sequences);
+
     friend std::unique_ptr<Polisher> createPolisher(const std::string& sequences_path,
         const std::string& overlaps_path, const std::string& target_path,
         PolisherType type, uint32_t window_length, double quality_threshold,
         double error_threshold, bool trim, int8_t match, int8_t mismatch, int8_t gap,
         uint32_t num_threads, uint32_t cuda_batches, bool cuda_banded_alignment,
-        uint32_t cudaaligner_batches, uint32_t cudaaligner_band_width);
+        uint32_t cudaaligner_batches, uint32_t cudaaligner_band_width,
+        uint64_t split_size, const std::string& cache_path, bool lazy_loading,
+        uint32_t shard, uint32_t num_shards, bool target_sorted,
+        int32_t max_depth, uint32_t poa_band_width, double agreement_threshold);
 
 protected:
     Polisher(std::unique_ptr<bioparser::Parser<Sequence>> sparser,
         std::unique_ptr<bioparser::Parser<Overlap>> oparser,
+        std::unique_ptr<OverlapParser> nparser,
         std::unique_ptr<bioparser::Parser<Sequence>> tparser,
         PolisherType type, uint32_t window_length, double quality_threshold,
         double error_threshold, bool trim, int8_t match, int8_t mismatch, int8_t gap,
-        uint32_t num_threads);
+        uint32_t num_threads, uint64_t split_size, bool lazy_loading,
+        uint32_t shard, uint32_t num_shards, bool target_sorted,
+        int32_t max_depth, uint32_t poa_band_width, double agreement_threshold,
+        std::unique_ptr<OverlapCache> cache);
     Polisher(const Polisher&) = delete;
     const Polisher& operator=(const Polisher&) = delete;
     virtual void find_overlap_breaking_points(std::vector<std::unique_ptr<Overlap>>& overlaps);
 
+    // pairs overlaps which are duals of each other, duals[i] is the index of
+    // the dual of overlaps[i] (or -1 if there is none)
+    void find_dual_overlaps(const std::vector<std::unique_ptr<Overlap>>& overlaps,
+        std::vector<uint64_t>& duals) const;
+
+    // rewinds and parses overlaps from either the native or the bioparser
+    // parser
+    void reset_overlaps();
+    std::vector<std::unique_ptr<Overlap>> parse_overlaps(uint64_t bytes);
+
+    // registers reads stored along SAM/BAM records (used when there is no
+    // sequences file) which overlap targets of this shard, ordinals of
+    // records are mapped to their ids through id_to_id_
+    void load_reads(std::vector<std::unique_ptr<Overlap>>& overlaps);
+
+    // parses all overlaps and passes those which are below the error
+    // threshold and hit a target to visit (along with the target id)
+    void scan_overlaps(const std::function<void(const Overlap&, uint64_t)>& visit,
+        const std::function<void()>& end_of_chunk);
+
+    // parses overlaps once, narrows [targets_begin, targets_end) to the
+    // targets of shard_ (if sharding) and collects hashed names (PAF/SAM) or
+    // ordinals (MHAP) of reads which overlap at least one of them (if
+    // find_reads)
+    void scan_targets(uint64_t& targets_begin, uint64_t& targets_end,
+        bool find_reads, std::vector<uint64_t>& names,
+        std::vector<bool>& ordinals);
+
+    // finds the range of targets which belongs to shard_ given the number of
+    // overlaps of each target
+    void find_shard(const std::vector<uint64_t>& coverages,
+        uint64_t& targets_begin, uint64_t& targets_end) const;
+
+    // transmutes overlaps [begin, end) in parallel and removes those which
+    // are invalid, above the error threshold or self overlaps
+    void transmute_overlaps(std::vector<std::unique_ptr<Overlap>>& overlaps,
+        uint64_t begin);
+
+    // updates the best overlap of each read (contig polishing) with overlaps
+    // [begin, end), where overlaps[i] has ordinal i + offset, reads are
+    // partitioned among threads and overlaps which lose are removed (those
+    // with ordinals below offset are no longer resident)
+    void rank_overlaps(std::vector<std::unique_ptr<Overlap>>& overlaps,
+        uint64_t begin, uint64_t offset, std::vector<OverlapRank>& ranks);
+
+    // loads overlaps of targets [targets_begin, targets_end) and creates their windows
+    void initialize_windows(uint64_t targets_begin, uint64_t targets_end);
+
+    // creates windows of targets (in the given order) with layers
+    // from overlaps (which are freed), layers are counted per window first
+    // and then stored into layers_ grouped by window, layers above the
+    // maximum depth are dropped
+    void create_windows(std::vector<std::unique_ptr<Overlap>>& overlaps,
+        const std::vector<uint64_t>& targets);
+
+    // sets the maximum depth from the median coverage of targets of this
+    // shard, targets_bases holds the total length of overlaps of each target
+    void find_max_depth(const std::vector<uint64_t>& targets_bases);
+
+    // parses overlaps grouped by target and polishes targets as soon as all
+    // of their overlaps are parsed (in the order of their groups, targets
+    // without overlaps last)
+    void polish_streaming(const SequenceSink& sink,
+        bool drop_unpolished_sequences);
+
+    // generates consensus of all windows and frees them afterwards
+    virtual void polish_windows(const SequenceSink& sink,
+        bool drop_unpolished_sequences);
+
     std::unique_ptr<bioparser::Parser<Sequence>> sparser_;
     std::unique_ptr<bioparser::Parser<Overlap>> oparser_;
+    // BAM and PAF overlaps are parsed natively instead of by oparser_
+    std::unique_ptr<OverlapParser> nparser_;
     std::unique_ptr<bioparser::Parser<Sequence>> tparser_;
 
     PolisherType type_;
@@ -83,13 +181,48 @@ protected:
     double error_threshold_;
     bool trim_;
     std::vector<std::shared_ptr<spoa::AlignmentEngine>> alignment_engines_;
+    // one per thread, same as alignment engines
+    std::vector<std::shared_ptr<ConsensusContext>> consensus_contexts_;
 
     std::vector<std::unique_ptr<Sequence>> sequences_;
+    uint64_t targets_size_;
     std::vector<uint32_t> targets_coverages_;
-    std::string dummy_quality_;
+
+    // targets are polished in contiguous splits of ~split_size_ bytes,
+    // reads are shared among splits and loaded only once, targets_splits_
+    // holds the boundaries of splits (starting with the first target)
+    uint64_t split_size_;
+    std::vector<uint64_t> targets_splits_;
+    std::unique_ptr<NameIndex> name_index_;
+    // MHAP ordinals of reads (or ordinals of SAM/BAM records) to ids
+    std::vector<uint64_t> id_to_id_;
+    // ordinal of the next parsed overlap
+    uint64_t overlaps_ordinal_;
+
+    // reads without overlaps to targets are skipped while loading
+    bool lazy_loading_;
+
+    // only targets of shard_ out of num_shards_ are polished
+    uint32_t shard_;
+    uint32_t num_shards_;
+
+    // overlaps are sorted by target so that only a few targets have to be
+    // resident at a time
+    bool target_sorted_;
+    bool is_streaming_;
+
+    // maximum number of layers per window (0 for no limit, negative until
+    // it is derived from the median coverage of targets)
+    int32_t max_depth_;
+
+    // breaking points of overlaps from a previous run (if any)
+    std::unique_ptr<OverlapCache> cache_;
 
     uint32_t window_length_;
-    std::vector<std::shared_ptr<Window>> windows_;
+    WindowType window_type_;
+    // windows in target order, each refers to its range of layers_
+    std::vector<Window> windows_;
+    std::vector<Layer> layers_;
 
     std::shared_ptr<thread_pool::ThreadPool> thread_pool_;
 
@@ -0,0 +1,152 @@
+/*!
+ * @file sam_parser.cpp
+ *
+ * @brief SamParser class source file
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "overlap.hpp"
+#include "sam_parser.hpp"
+
+#include "zlib.h"
+
+namespace racon {
+
+constexpr uint32_t kBufferSize = 1024 * 1024; // ~ 1MB
+constexpr uint32_t kNumMandatoryFields = 11;
+
+std::unique_ptr<SamParser> createSamParser(const std::string& path,
+    bool keep_queries) {
+
+    gzFile input = gzopen(path.c_str(), "r");
+    if (input == nullptr) {
+        fprintf(stderr, "[racon::createSamParser] error: "
+            "unable to open file %s!\n", path.c_str());
+        exit(1);
+    }
+
+    return std::unique_ptr<SamParser>(new SamParser(input, path, keep_queries));
+}
+
+SamParser::SamParser(gzFile input, const std::string& path, bool keep_queries)
+        : input_(input), path_(path), keep_queries_(keep_queries),
+        buffer_(kBufferSize), buffer_begin_(0), buffer_end_(0), line_(),
+        fields_() {
+}
+
+SamParser::~SamParser() {
+    gzclose(input_);
+}
+
+void SamParser::reset() {
+    gzseek(input_, 0, SEEK_SET);
+    buffer_begin_ = 0;
+    buffer_end_ = 0;
+}
+
+bool SamParser::read_line() {
+
+    line_.clear();
+    bool has_data = false;
+    while (true) {
+        if (buffer_begin_ == buffer_end_) {
+            int32_t length = gzread(input_, buffer_.data(), buffer_.size());
+            if (length < 0) {
+                fprintf(stderr, "[racon::SamParser::parse] error: "
+                    "unable to read file %s!\n", path_.c_str());
+                exit(1);
+            }
+            if (length == 0) {
+                break;
+            }
+            buffer_begin_ = 0;
+            buffer_end_ = length;
+        }
+        has_data = true;
+
+        const char* begin = &buffer_[buffer_begin_];
+        const char* end = static_cast<const char*>(memchr(begin, '\n',
+            buffer_end_ - buffer_begin_));
+        if (end == nullptr) {
+            line_.append(begin, buffer_end_ - buffer_begin_);
+            buffer_begin_ = buffer_end_;
+        } else {
+            line_.append(begin, end - begin);
+            buffer_begin_ += end - begin + 1;
+            break;
+        }
+    }
+
+    if (!line_.empty() && line_.back() == '\r') {
+        line_.pop_back();
+    }
+    return has_data;
+}
+
+std::unique_ptr<Overlap> SamParser::parse_line() {
+
+    fields_.clear();
+    const char* begin = line_.c_str();
+    const char* end = begin + line_.size();
+    while (true) {
+        const char* tab = static_cast<const char*>(memchr(begin, '\t', end - begin));
+        fields_.emplace_back(begin, (tab == nullptr ? end : tab) - begin);
+        if (tab == nullptr) {
+            break;
+        }
+        begin = tab + 1;
+    }
+
+    auto number = [] (const std::pair<const char*, uint32_t>& field,
+        uint32_t& dst) -> bool {
+        char* field_end;
+        dst = strtoul(field.first, &field_end, 10);
+        return field.second != 0 && field_end == field.first + field.second;
+    };
+
+    uint32_t flag = 0, t_begin = 0;
+    if (fields_.size() < kNumMandatoryFields || fields_[0].second == 0 ||
+        !number(fields_[1], flag) || !number(fields_[3], t_begin)) {
+        fprintf(stderr, "[racon::SamParser::parse] error: "
+            "invalid line in file %s!\n", path_.c_str());
+        exit(1);
+    }
+
+    std::unique_ptr<Overlap> overlap(new Overlap(fields_[0].first,
+        fields_[0].second, flag, fields_[2].first, fields_[2].second, t_begin,
+        fields_[5].first, fields_[5].second));
+
+    // '*' marks a missing sequence or quality
+    const auto& sequence = fields_[9];
+    const auto& quality = fields_[10];
+    if (keep_queries_ && overlap->is_valid() &&
+        !(sequence.second == 1 && sequence.first[0] == '*')) {
+        overlap->store_query(flag, sequence.first, sequence.second,
+            quality.first, quality.second == 1 && quality.first[0] == '*' ?
+            0 : quality.second);
+    }
+
+    return overlap;
+}
+
+std::vector<std::unique_ptr<Overlap>> SamParser::parse(uint64_t bytes,
+    const std::shared_ptr<thread_pool::ThreadPool>&) {
+
+    std::vector<std::unique_ptr<Overlap>> dst;
+
+    uint64_t parsed_bytes = 0;
+    while (parsed_bytes < bytes && read_line()) {
+        parsed_bytes += line_.size() + 1;
+        if (line_.empty() || line_[0] == '@') {
+            continue;
+        }
+        dst.emplace_back(parse_line());
+    }
+
+    return dst;
+}
+
+}
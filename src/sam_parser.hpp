@@ -0,0 +1,62 @@
+/*!
+ * @file sam_parser.hpp
+ *
+ * @brief SamParser class header file
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <vector>
+#include <string>
+#include <utility>
+
+#include "overlap_parser.hpp"
+
+typedef struct gzFile_s* gzFile;
+
+namespace racon {
+
+class SamParser;
+std::unique_ptr<SamParser> createSamParser(const std::string& path,
+    bool keep_queries);
+
+/*!
+ * @brief Parses overlaps from SAM files (can be compressed with gzip), bases
+ * and qualities of primary records are kept along with their overlaps only if
+ * keep_queries is set (i.e. reads are not loaded from a sequences file)
+ */
+class SamParser: public OverlapParser {
+public:
+    ~SamParser();
+
+    void reset() override;
+
+    std::vector<std::unique_ptr<Overlap>> parse(uint64_t bytes,
+        const std::shared_ptr<thread_pool::ThreadPool>& thread_pool) override;
+
+    friend std::unique_ptr<SamParser> createSamParser(const std::string& path,
+        bool keep_queries);
+private:
+    SamParser(gzFile input, const std::string& path, bool keep_queries);
+    SamParser(const SamParser&) = delete;
+    const SamParser& operator=(const SamParser&) = delete;
+
+    // reads the next line into line_ (without the newline), returns false at
+    // the end of file
+    bool read_line();
+    std::unique_ptr<Overlap> parse_line();
+
+    gzFile input_;
+    std::string path_;
+    bool keep_queries_;
+    std::vector<char> buffer_;
+    uint32_t buffer_begin_;
+    uint32_t buffer_end_;
+    std::string line_;
+    // fields of the current line as (begin, length)
+    std::vector<std::pair<const char*, uint32_t>> fields_;
+};
+
+}
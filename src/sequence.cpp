@@ -5,6 +5,10 @@
  */
 
 #include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
 
 #include "sequence.hpp"
 
@@ -16,15 +20,27 @@ std::unique_ptr<Sequence> createSequence(const std::string& name,
     return std::unique_ptr<Sequence>(new Sequence(name, data));
 }
 
+std::unique_ptr<Sequence> createSequence(const std::string& name,
+    const char* data, uint32_t data_length, const char* quality,
+    uint32_t quality_length, uint32_t strand) {
+
+    auto sequence = std::unique_ptr<Sequence>(new Sequence(name.c_str(),
+        name.size(), data, data_length, quality, quality_length));
+    if (strand) {
+        sequence->create_reverse_complement();
+        sequence->data_.swap(sequence->reverse_complement_);
+        sequence->quality_.swap(sequence->reverse_quality_);
+        std::string().swap(sequence->reverse_complement_);
+        std::string().swap(sequence->reverse_quality_);
+    }
+    return sequence;
+}
+
 Sequence::Sequence(const char* name, uint32_t name_length, const char* data,
     uint32_t data_length)
-        : name_(name, name_length), data_(), reverse_complement_(), quality_(),
+        : name_(name, name_length), length_(data_length), data_(data, data_length),
+        packed_data_(), exceptions_(), reverse_complement_(), quality_(),
         reverse_quality_() {
-
-    data_.reserve(data_length);
-    for (uint32_t i = 0; i < data_length; ++i) {
-        data_ += toupper(data[i]);
-    }
 }
 
 Sequence::Sequence(const char* name, uint32_t name_length, const char* data,
@@ -42,8 +58,97 @@ Sequence::Sequence(const char* name, uint32_t name_length, const char* data,
 }
 
 Sequence::Sequence(const std::string& name, const std::string& data)
-    : name_(name), data_(data), reverse_complement_(), quality_(),
-    reverse_quality_() {
+    : name_(name), length_(data.size()), data_(data), packed_data_(),
+    exceptions_(), reverse_complement_(), quality_(), reverse_quality_() {
+}
+
+static char complement(char base) {
+    switch (base) {
+        case 'A':
+            return 'T';
+        case 'T':
+            return 'A';
+        case 'C':
+            return 'G';
+        case 'G':
+            return 'C';
+        default:
+            return base;
+    }
+}
+
+void Sequence::decode_data(uint32_t begin, uint32_t length, uint32_t strand,
+    char* dst) const {
+
+    if (length == 0) {
+        return;
+    }
+    if (begin + length > length_) {
+        fprintf(stderr, "[racon::Sequence::decode_data] error: "
+            "range out of bounds for sequence %s!\n", name_.c_str());
+        exit(1);
+    }
+
+    if (packed_data_.empty()) {
+        if (!strand) {
+            for (uint32_t i = 0; i < length; ++i) {
+                dst[i] = toupper(data_[begin + i]);
+            }
+        } else {
+            for (uint32_t i = 0; i < length; ++i) {
+                dst[i] = complement(toupper(data_[length_ - 1 - begin - i]));
+            }
+        }
+        return;
+    }
+
+    static const char kBases[] = "ACGT";
+
+    if (!strand) {
+        for (uint32_t i = 0, j = begin; i < length; ++i, ++j) {
+            dst[i] = kBases[(packed_data_[j >> 5] >> ((j & 31) << 1)) & 3];
+        }
+    } else {
+        for (uint32_t i = 0, j = length_ - 1 - begin; i < length; ++i, --j) {
+            dst[i] = kBases[3 - ((packed_data_[j >> 5] >> ((j & 31) << 1)) & 3)];
+        }
+    }
+
+    // non ACGT bases are not complemented (same as in create_reverse_complement)
+    uint32_t first = strand ? length_ - begin - length : begin;
+    uint32_t last = first + length;
+    auto it = std::lower_bound(exceptions_.begin(), exceptions_.end(), first,
+        [] (const Exception& lhs, uint32_t rhs) -> bool {
+            return lhs.begin + lhs.length <= rhs;
+        });
+    for (; it != exceptions_.end() && it->begin < last; ++it) {
+        uint32_t j = std::max(it->begin, first);
+        uint32_t end = std::min(it->begin + it->length, last);
+        for (; j < end; ++j) {
+            dst[strand ? length_ - 1 - j - begin : j - begin] = it->base;
+        }
+    }
+}
+
+void Sequence::decode_quality(uint32_t begin, uint32_t length, uint32_t strand,
+    char* dst) const {
+
+    if (length == 0) {
+        return;
+    }
+    if (begin + length > quality_.size()) {
+        fprintf(stderr, "[racon::Sequence::decode_quality] error: "
+            "range out of bounds for sequence %s!\n", name_.c_str());
+        exit(1);
+    }
+
+    if (!strand) {
+        memcpy(dst, &quality_[begin], length);
+    } else {
+        for (uint32_t i = 0; i < length; ++i) {
+            dst[i] = quality_[length_ - 1 - begin - i];
+        }
+    }
 }
 
 void Sequence::create_reverse_complement() {
@@ -52,50 +157,67 @@ void Sequence::create_reverse_complement() {
         return;
     }
 
-    reverse_complement_.clear();
-    reverse_complement_.reserve(data_.size());
+    reverse_complement_.resize(length_);
+    decode_data(0, length_, 1, &reverse_complement_[0]);
+
+    reverse_quality_.resize(quality_.size());
+    decode_quality(0, quality_.size(), 1, &reverse_quality_[0]);
+}
+
+void Sequence::pack() {
+
+    if (data_.empty()) {
+        return;
+    }
 
-    for (int32_t i = data_.size() - 1; i >= 0; --i) {
-        switch (data_[i]) {
+    packed_data_.assign((length_ + 31) / 32, 0);
+    for (uint32_t i = 0; i < length_; ++i) {
+        uint64_t code = 0;
+        char base = toupper(data_[i]);
+        switch (base) {
             case 'A':
-                reverse_complement_ += 'T';
-                break;
-            case 'T':
-                reverse_complement_ += 'A';
                 break;
             case 'C':
-                reverse_complement_ += 'G';
+                code = 1;
                 break;
             case 'G':
-                reverse_complement_ += 'C';
+                code = 2;
+                break;
+            case 'T':
+                code = 3;
                 break;
             default:
-                reverse_complement_ += data_[i];
+                if (!exceptions_.empty() && exceptions_.back().base == base &&
+                    exceptions_.back().begin + exceptions_.back().length == i) {
+                    ++exceptions_.back().length;
+                } else {
+                    exceptions_.push_back({i, 1, base});
+                }
                 break;
         }
+        packed_data_[i >> 5] |= code << ((i & 31) << 1);
     }
+    exceptions_.shrink_to_fit();
 
-    reverse_quality_.clear();
-    reverse_quality_.reserve(quality_.size());
-
-    for (int32_t i = quality_.size() - 1; i >= 0; --i) {
-        reverse_quality_ += quality_[i];
-    }
+    std::string().swap(data_);
 }
 
-void Sequence::transmute(bool has_name, bool has_data, bool has_reverse_data) {
+void Sequence::transmute(bool has_name, bool has_data) {
 
     if (!has_name) {
         std::string().swap(name_);
     }
 
-    if (has_reverse_data) {
-        create_reverse_complement();
-    }
+    std::string().swap(reverse_complement_);
+    std::string().swap(reverse_quality_);
 
     if (!has_data) {
         std::string().swap(data_);
+        std::vector<uint64_t>().swap(packed_data_);
+        std::vector<Exception>().swap(exceptions_);
         std::string().swap(quality_);
+    } else {
+        pack();
     }
 }
 
@@ -25,6 +25,14 @@ class Sequence;
 std::unique_ptr<Sequence> createSequence(const std::string& name,
     const std::string& data);
 
+/*!
+ * @brief Creates a read from bases and qualities of a SAM/BAM record which
+ * are reverse complemented back if the record is on the reverse strand
+ */
+std::unique_ptr<Sequence> createSequence(const std::string& name,
+    const char* data, uint32_t data_length, const char* quality,
+    uint32_t quality_length, uint32_t strand);
+
 class Sequence {
 public:
     ~Sequence() = default;
@@ -33,6 +41,10 @@ public:
         return name_;
     }
 
+    /*!
+     * @brief Returns data as parsed (case is preserved), empty after transmute
+     * packed the sequence (use decode_data() instead which is always uppercase)
+     */
     const std::string& data() const {
         return data_;
     }
@@ -49,14 +61,38 @@ public:
         return reverse_quality_;
     }
 
+    uint32_t length() const {
+        return length_;
+    }
+
+    /*!
+     * @brief Copies length bases starting at begin of the sequence (strand == 0)
+     * or of its reverse complement (strand == 1) to dst
+     */
+    void decode_data(uint32_t begin, uint32_t length, uint32_t strand,
+        char* dst) const;
+
+    /*!
+     * @brief Same as decode_data() for qualities, sequence must have them
+     */
+    void decode_quality(uint32_t begin, uint32_t length, uint32_t strand,
+        char* dst) const;
+
     void create_reverse_complement();
 
-    void transmute(bool has_name, bool has_data, bool has_reverse_data);
+    /*!
+     * @brief Drops name and/or data if they are not needed anymore, otherwise
+     * packs data into 2 bits per base (non ACGT bases are kept aside)
+     */
+    void transmute(bool has_name, bool has_data);
 
     friend bioparser::FastaParser<Sequence>;
     friend bioparser::FastqParser<Sequence>;
     friend std::unique_ptr<Sequence> createSequence(const std::string& name,
         const std::string& data);
+    friend std::unique_ptr<Sequence> createSequence(const std::string& name,
+        const char* data, uint32_t data_length, const char* quality,
+        uint32_t quality_length, uint32_t strand);
 private:
     Sequence(const char* name, uint32_t name_length, const char* data,
         uint32_t data_length);
@@ -65,9 +101,19 @@ private:
     Sequence(const std::string& name, const std::string& data);
     Sequence(const Sequence&) = delete;
     const Sequence& operator=(const Sequence&) = delete;
+    void pack();
+
+    struct Exception {
+        uint32_t begin;
+        uint32_t length;
+        char base;
+    };
 
     std::string name_;
+    uint32_t length_;
     std::string data_;
+    std::vector<uint64_t> packed_data_;
+    std::vector<Exception> exceptions_;
     std::string reverse_complement_;
     std::string quality_;
     std::string reverse_quality_;
@@ -0,0 +1,209 @@
+/*!
+ * @file sequence_writer.cpp
+ *
+ * @brief SequenceWriter class source file
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "sequence.hpp"
+#include "sequence_writer.hpp"
+
+#include "zlib.h"
+
+namespace racon {
+
+constexpr uint32_t kQueueSize = 64;
+constexpr uint32_t kBufferSize = 1024 * 1024; // ~ 1MB
+// uncompressed bytes per BGZF block (as in htslib) so that even incompressible
+// data fits into the 64KB limit of a compressed block
+constexpr uint32_t kBgzfBlockSize = 0xff00;
+constexpr uint32_t kBgzfMaxBlockSize = 0x10000;
+constexpr uint32_t kBgzfHeaderSize = 18;
+constexpr uint32_t kBgzfFooterSize = 8;
+constexpr unsigned char kBgzfHeader[kBgzfHeaderSize] = {
+    31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0, 0, 0
+};
+constexpr unsigned char kBgzfEof[28] = {
+    31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0, 27, 0, 3, 0,
+    0, 0, 0, 0, 0, 0, 0, 0
+};
+
+void writeLittleEndian(unsigned char* dst, uint32_t value, uint32_t num_bytes) {
+    for (uint32_t i = 0; i < num_bytes; ++i, value >>= 8) {
+        dst[i] = value & 0xFF;
+    }
+}
+
+void writeBgzfBlock(FILE* output, const char* data, uint32_t data_length) {
+
+    std::vector<unsigned char> block(kBgzfMaxBlockSize);
+    memcpy(block.data(), kBgzfHeader, kBgzfHeaderSize);
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+        Z_DEFAULT_STRATEGY) != Z_OK) {
+        fprintf(stderr, "[racon::SequenceWriter::write] error: "
+            "unable to initialize compression!\n");
+        exit(1);
+    }
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream.avail_in = data_length;
+    stream.next_out = block.data() + kBgzfHeaderSize;
+    stream.avail_out = kBgzfMaxBlockSize - kBgzfHeaderSize - kBgzfFooterSize;
+    if (deflate(&stream, Z_FINISH) != Z_STREAM_END) {
+        fprintf(stderr, "[racon::SequenceWriter::write] error: "
+            "unable to compress block!\n");
+        exit(1);
+    }
+    uint32_t block_length = kBgzfHeaderSize + stream.total_out + kBgzfFooterSize;
+    deflateEnd(&stream);
+
+    uint32_t crc = crc32(crc32(0, Z_NULL, 0),
+        reinterpret_cast<const Bytef*>(data), data_length);
+
+    writeLittleEndian(&block[16], block_length - 1, 2);
+    writeLittleEndian(&block[block_length - kBgzfFooterSize], crc, 4);
+    writeLittleEndian(&block[block_length - 4], data_length, 4);
+
+    fwrite(block.data(), 1, block_length, output);
+}
+
+std::unique_ptr<SequenceWriter> createSequenceWriter(const std::string& path,
+    uint32_t line_width) {
+
+    if (path.empty()) {
+        return std::unique_ptr<SequenceWriter>(new SequenceWriter(stdout,
+            false, line_width));
+    }
+
+    FILE* output = fopen(path.c_str(), "wb");
+    if (output == nullptr) {
+        fprintf(stderr, "[racon::createSequenceWriter] error: "
+            "unable to open file %s!\n", path.c_str());
+        exit(1);
+    }
+
+    bool is_compressed = path.size() >= 3 &&
+        path.compare(path.size() - 3, 3, ".gz") == 0;
+
+    return std::unique_ptr<SequenceWriter>(new SequenceWriter(output,
+        is_compressed, line_width));
+}
+
+SequenceWriter::SequenceWriter(FILE* output, bool is_compressed,
+    uint32_t line_width)
+        : output_(output), is_compressed_(is_compressed),
+        line_width_(line_width), buffer_(), queue_(), is_closed_(false),
+        mutex_(), queue_not_empty_(), queue_not_full_(),
+        thread_(&SequenceWriter::run, this) {
+}
+
+SequenceWriter::~SequenceWriter() {
+    close();
+}
+
+void SequenceWriter::write(std::unique_ptr<Sequence> sequence) {
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (is_closed_) {
+        fprintf(stderr, "[racon::SequenceWriter::write] error: "
+            "writer is closed!\n");
+        exit(1);
+    }
+    queue_not_full_.wait(lock, [&] () -> bool {
+        return queue_.size() < kQueueSize;
+    });
+    queue_.emplace_back(std::move(sequence));
+    lock.unlock();
+
+    queue_not_empty_.notify_one();
+}
+
+void SequenceWriter::close() {
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (is_closed_) {
+            return;
+        }
+        is_closed_ = true;
+    }
+    queue_not_empty_.notify_one();
+    thread_.join();
+
+    bool is_valid = ferror(output_) == 0;
+    is_valid &= (output_ == stdout ? fflush(output_) : fclose(output_)) == 0;
+    if (!is_valid) {
+        fprintf(stderr, "[racon::SequenceWriter::close] error: "
+            "unable to write sequences!\n");
+        exit(1);
+    }
+}
+
+void SequenceWriter::run() {
+
+    while (true) {
+        std::unique_ptr<Sequence> sequence;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            queue_not_empty_.wait(lock, [&] () -> bool {
+                return !queue_.empty() || is_closed_;
+            });
+            if (queue_.empty()) {
+                break;
+            }
+            sequence = std::move(queue_.front());
+            queue_.pop_front();
+        }
+        queue_not_full_.notify_one();
+
+        buffer_ += '>';
+        buffer_ += sequence->name();
+        buffer_ += '\n';
+
+        const auto& data = sequence->data();
+        if (line_width_ == 0) {
+            buffer_ += data;
+            buffer_ += '\n';
+        } else {
+            for (uint64_t i = 0; i < data.size(); i += line_width_) {
+                buffer_.append(data, i, line_width_);
+                buffer_ += '\n';
+            }
+        }
+
+        if (buffer_.size() >= kBufferSize) {
+            flush(false);
+        }
+    }
+
+    flush(true);
+}
+
+void SequenceWriter::flush(bool is_final) {
+
+    if (!is_compressed_) {
+        fwrite(buffer_.data(), 1, buffer_.size(), output_);
+        buffer_.clear();
+        return;
+    }
+
+    uint64_t i = 0;
+    for (; i + kBgzfBlockSize <= buffer_.size(); i += kBgzfBlockSize) {
+        writeBgzfBlock(output_, &buffer_[i], kBgzfBlockSize);
+    }
+    if (is_final) {
+        if (i < buffer_.size()) {
+            writeBgzfBlock(output_, &buffer_[i], buffer_.size() - i);
+        }
+        fwrite(kBgzfEof, 1, sizeof(kBgzfEof), output_);
+        i = buffer_.size();
+    }
+    buffer_.erase(0, i);
+}
+
+}
@@ -0,0 +1,70 @@
+/*!
+ * @file sequence_writer.hpp
+ *
+ * @brief SequenceWriter class header file
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <memory>
+#include <string>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+namespace racon {
+
+class Sequence;
+
+class SequenceWriter;
+std::unique_ptr<SequenceWriter> createSequenceWriter(const std::string& path,
+    uint32_t line_width);
+
+/*!
+ * @brief Writes sequences in FASTA format on a dedicated thread, output is
+ * stdout if path is empty and BGZF compressed (readable with gzip) if path
+ * ends with .gz, data is wrapped to line_width characters (0 disables it)
+ */
+class SequenceWriter {
+public:
+    ~SequenceWriter();
+
+    /*!
+     * @brief Queues sequence for writing, blocks while the queue is full
+     */
+    void write(std::unique_ptr<Sequence> sequence);
+
+    /*!
+     * @brief Writes all queued sequences and closes the output
+     */
+    void close();
+
+    friend std::unique_ptr<SequenceWriter> createSequenceWriter(
+        const std::string& path, uint32_t line_width);
+private:
+    SequenceWriter(FILE* output, bool is_compressed, uint32_t line_width);
+    SequenceWriter(const SequenceWriter&) = delete;
+    const SequenceWriter& operator=(const SequenceWriter&) = delete;
+
+    // body of the writer thread
+    void run();
+    // writes whole BGZF blocks of buffer_ (all of it if is_final)
+    void flush(bool is_final);
+
+    FILE* output_;
+    bool is_compressed_;
+    uint32_t line_width_;
+    std::string buffer_;
+
+    std::deque<std::unique_ptr<Sequence>> queue_;
+    bool is_closed_;
+    std::mutex mutex_;
+    std::condition_variable queue_not_empty_;
+    std::condition_variable queue_not_full_;
+    std::thread thread_;
+};
+
+}
@@ -4,126 +4,537 @@
  * @brief Window class source file
  */
 
+#include <math.h>
 #include <algorithm>
+#include <limits>
 
+#include "sequence.hpp"
 #include "window.hpp"
 
 #include "spoa/spoa.hpp"
 
 namespace racon {
 
-std::shared_ptr<Window> createWindow(uint64_t id, uint32_t rank, WindowType type,
-    const char* backbone, uint32_t backbone_length, const char* quality,
-    uint32_t quality_length) {
+struct ConsensusContext {
+    ConsensusContext(int8_t match, int8_t mismatch, int8_t gap,
+        uint32_t band_width, double agreement_threshold)
+            : match(match), mismatch(mismatch), gap(gap),
+            band_width(band_width), agreement_threshold(agreement_threshold),
+            data(), quality(), sequences(), qualities(), graph(), rank(),
+            mapping(), coverages(), node_ranks(), path_lengths(), bands(),
+            band_offsets(), scores(), kmers(), kmer_support(), kmer_stamps() {
+    }
+
+    int8_t match;
+    int8_t mismatch;
+    int8_t gap;
+    uint32_t band_width;
+    double agreement_threshold;
+
+    // decoded layers
+    std::string data;
+    std::string quality;
+    std::vector<std::pair<const char*, uint32_t>> sequences;
+    std::vector<std::pair<const char*, uint32_t>> qualities;
+
+    spoa::Graph graph;
+    std::vector<uint32_t> rank;
+    std::vector<const spoa::Graph::Node*> mapping;
+    std::vector<uint32_t> coverages;
+
+    // banded alignment, nodes are indexed by rank, bands are inclusive ranges
+    // of sequence positions and rows of scores are stored one after another
+    std::vector<uint32_t> node_ranks;
+    std::vector<std::pair<uint32_t, uint32_t>> path_lengths;
+    std::vector<std::pair<uint32_t, uint32_t>> bands;
+    std::vector<uint64_t> band_offsets;
+    std::vector<int32_t> scores;
+
+    // agreement with the backbone, sorted backbone k-mers with their
+    // positions, number of layers containing each of them and the last layer
+    // which was counted for each of them
+    std::vector<std::pair<uint32_t, uint32_t>> kmers;
+    std::vector<uint32_t> kmer_support;
+    std::vector<uint32_t> kmer_stamps;
+};
+
+std::shared_ptr<ConsensusContext> createConsensusContext(int8_t match,
+    int8_t mismatch, int8_t gap, uint32_t band_width,
+    double agreement_threshold) {
+    return std::make_shared<ConsensusContext>(match, mismatch, gap, band_width,
+        agreement_threshold);
+}
+
+constexpr uint32_t kAgreementKmerLength = 15;
+
+// calls f(kmer, position) for each k-mer of sequence which contains only
+// A, C, G and T (packed 2 bits per base)
+template<typename F>
+void forEachKmer(const char* sequence, uint32_t sequence_length, F f) {
+
+    constexpr uint32_t kMask = (1U << (2 * kAgreementKmerLength)) - 1;
+
+    uint32_t kmer = 0;
+    for (uint32_t i = 0, valid = 0; i < sequence_length; ++i) {
+        uint32_t code = 0;
+        switch (sequence[i]) {
+            case 'A': case 'a': code = 0; break;
+            case 'C': case 'c': code = 1; break;
+            case 'G': case 'g': code = 2; break;
+            case 'T': case 't': code = 3; break;
+            default: valid = 0; continue;
+        }
+        kmer = ((kmer << 2) | code) & kMask;
+        if (++valid >= kAgreementKmerLength) {
+            f(kmer, i + 1 - kAgreementKmerLength);
+        }
+    }
+}
+
+// share of layers which agree with the backbone, i.e. span it as a whole
+// (start and end within offset of its ends) and have most of their k-mers in
+// it, 0 if there are fewer than two spanning layers or if any two adjacent
+// backbone bases are not covered by a backbone k-mer which occurs in more than
+// half of the spanning layers (a single wrong, missing or surplus base)
+double backboneAgreement(
+    const std::vector<std::pair<const char*, uint32_t>>& sequences,
+    const Layer* layers, uint32_t offset, ConsensusContext& context) {
+
+    const auto& backbone = sequences.front();
+
+    auto& kmers = context.kmers;
+    kmers.clear();
+    forEachKmer(backbone.first, backbone.second, [&] (uint32_t kmer,
+        uint32_t position) { kmers.emplace_back(kmer, position); });
+    if (kmers.empty()) {
+        return 0;
+    }
+    std::sort(kmers.begin(), kmers.end());
+
+    auto& kmer_support = context.kmer_support;
+    kmer_support.assign(backbone.second, 0);
+    auto& kmer_stamps = context.kmer_stamps;
+    kmer_stamps.assign(backbone.second, 0);
+
+    uint32_t num_spanning_layers = 0, num_agreeing_layers = 0;
+    for (uint32_t i = 1; i < sequences.size(); ++i) {
+        if (layers[i].begin >= offset || layers[i].end <= backbone.second - offset) {
+            continue;
+        }
+        ++num_spanning_layers;
+
+        uint32_t num_kmers = 0, num_shared_kmers = 0;
+        forEachKmer(sequences[i].first, sequences[i].second, [&] (uint32_t kmer,
+            uint32_t) {
+            ++num_kmers;
+            auto it = std::lower_bound(kmers.begin(), kmers.end(),
+                std::make_pair(kmer, 0U));
+            if (it != kmers.end() && it->first == kmer) {
+                ++num_shared_kmers;
+            }
+            for (; it != kmers.end() && it->first == kmer; ++it) {
+                if (kmer_stamps[it->second] != i) {
+                    kmer_stamps[it->second] = i;
+                    ++kmer_support[it->second];
+                }
+            }
+        });
+        if (2 * num_shared_kmers > num_kmers) {
+            ++num_agreeing_layers;
+        }
+    }
+
+    if (num_spanning_layers < 2) {
+        return 0;
+    }
+
+    // backbone bases [0, end] are chained by supported k-mers, kmer_support
+    // is indexed by k-mer positions
+    uint32_t end = 0;
+    for (uint32_t i = 0; i + kAgreementKmerLength <= backbone.second && i <= end; ++i) {
+        if (2 * kmer_support[i] > num_spanning_layers) {
+            end = std::max(end, i + kAgreementKmerLength - 1);
+        }
+    }
+    if (end + 1 != backbone.second) {
+        return 0;
+    }
+
+    return num_agreeing_layers / static_cast<double>(sequences.size() - 1);
+}
+
+constexpr int32_t kNegativeInfinity = std::numeric_limits<int32_t>::min() / 2;
+
+// global alignment with linear gaps (same as spoa::AlignmentType::kNW) which
+// fills only cells of node i whose sequence positions lie within band_width of
+// [shortest, longest] path from the start to i (scaled to the sequence
+// length), the band is doubled and the alignment repeated while the best path
+// touches the edge of the band
+spoa::Alignment alignBanded(const char* sequence, uint32_t sequence_length,
+    const spoa::Graph& graph, ConsensusContext& context) {
+
+    const auto& rank_to_node = graph.rank_to_node();
+    uint32_t num_nodes = rank_to_node.size();
+    if (num_nodes == 0 || sequence_length == 0) {
+        return spoa::Alignment();
+    }
+
+    auto& node_ranks = context.node_ranks;
+    node_ranks.resize(graph.nodes().size());
+    for (uint32_t i = 0; i < num_nodes; ++i) {
+        node_ranks[rank_to_node[i]->id] = i;
+    }
+
+    auto& path_lengths = context.path_lengths;
+    path_lengths.resize(num_nodes);
+    uint32_t graph_length = 1;
+    for (uint32_t i = 0; i < num_nodes; ++i) {
+        const auto& inedges = rank_to_node[i]->inedges;
+        if (inedges.empty()) {
+            path_lengths[i] = std::make_pair(1U, 1U);
+            continue;
+        }
+        path_lengths[i] = std::make_pair(std::numeric_limits<uint32_t>::max(), 0U);
+        for (const auto& it: inedges) {
+            const auto& lengths = path_lengths[node_ranks[it->tail->id]];
+            path_lengths[i].first = std::min(path_lengths[i].first, lengths.first + 1);
+            path_lengths[i].second = std::max(path_lengths[i].second, lengths.second + 1);
+        }
+        graph_length = std::max(graph_length, path_lengths[i].second);
+    }
+    double scale = sequence_length / static_cast<double>(graph_length);
+
+    auto& bands = context.bands;
+    auto& band_offsets = context.band_offsets;
+    auto& scores = context.scores;
+    bands.resize(num_nodes);
+    band_offsets.resize(num_nodes + 1);
+
+    // row -1 is the virtual start
+    auto score = [&] (int64_t i, uint32_t j) -> int32_t {
+        if (i < 0) {
+            return j * context.gap;
+        }
+        if (j < bands[i].first || j > bands[i].second) {
+            return kNegativeInfinity;
+        }
+        return scores[band_offsets[i] + j - bands[i].first];
+    };
+
+    uint64_t band_width = std::max(context.band_width, 1U);
+    while (true) {
+        bool is_full = band_width >= sequence_length;
+        for (uint32_t i = 0; i < num_nodes; ++i) {
+            if (is_full) {
+                bands[i] = std::make_pair(0U, sequence_length);
+            } else {
+                int64_t begin = static_cast<int64_t>(path_lengths[i].first * scale) -
+                    band_width;
+                int64_t end = static_cast<int64_t>(ceil(path_lengths[i].second * scale)) +
+                    band_width;
+                bands[i].first = std::max(begin, static_cast<int64_t>(0));
+                bands[i].second = std::min(end, static_cast<int64_t>(sequence_length));
+            }
+            band_offsets[i + 1] = band_offsets[i] + bands[i].second - bands[i].first + 1;
+        }
+        scores.resize(band_offsets[num_nodes]);
+
+        int32_t max_score = kNegativeInfinity;
+        int64_t max_i = -1;
+        for (uint32_t i = 0; i < num_nodes; ++i) {
+            const auto& node = rank_to_node[i];
+            char base = graph.decoder(node->code);
+            int32_t* row = &scores[band_offsets[i]] - bands[i].first;
 
-    if (backbone_length == 0 || backbone_length != quality_length) {
+            for (uint32_t j = bands[i].first; j <= bands[i].second; ++j) {
+                int32_t h = kNegativeInfinity;
+                int32_t substitution = j == 0 ? 0 : (sequence[j - 1] == base ?
+                    context.match : context.mismatch);
+                if (node->inedges.empty()) {
+                    if (j > 0) {
+                        h = std::max(h, score(-1, j - 1) + substitution);
+                    }
+                    h = std::max(h, score(-1, j) + context.gap);
+                }
+                for (const auto& it: node->inedges) {
+                    uint32_t k = node_ranks[it->tail->id];
+                    if (j > 0) {
+                        h = std::max(h, score(k, j - 1) + substitution);
+                    }
+                    h = std::max(h, score(k, j) + context.gap);
+                }
+                if (j > bands[i].first) {
+                    h = std::max(h, row[j - 1] + context.gap);
+                }
+                row[j] = std::max(h, kNegativeInfinity);
+            }
+
+            if (node->outedges.empty() && bands[i].second == sequence_length &&
+                max_score < row[sequence_length]) {
+                max_score = row[sequence_length];
+                max_i = i;
+            }
+        }
+
+        bool is_on_edge = max_i == -1;
+        spoa::Alignment alignment;
+        int64_t i = max_i;
+        uint32_t j = sequence_length;
+        while (!is_on_edge && (i != -1 || j != 0)) {
+            if (i == -1) {
+                alignment.emplace_back(-1, --j);
+                continue;
+            }
+            if ((j == bands[i].first && j != 0) ||
+                (j == bands[i].second && j != sequence_length)) {
+                is_on_edge = true;
+                break;
+            }
+
+            const auto& node = rank_to_node[i];
+            int32_t h = score(i, j);
+            int64_t next_i = i;
+            uint32_t next_j = j;
+
+            // same order of preference as in spoa
+            auto find_predecessor = [&] (uint32_t k, int32_t cost) -> bool {
+                if (node->inedges.empty()) {
+                    next_i = -1;
+                    return h == score(-1, k) + cost;
+                }
+                for (const auto& it: node->inedges) {
+                    next_i = node_ranks[it->tail->id];
+                    if (h == score(next_i, k) + cost) {
+                        return true;
+                    }
+                }
+                return false;
+            };
+
+            if (j > 0 && find_predecessor(j - 1, sequence[j - 1] == graph.decoder(
+                node->code) ? context.match : context.mismatch)) {
+                next_j = j - 1;
+            } else if (!find_predecessor(j, context.gap)) {
+                next_i = i;
+                next_j = j - 1;
+            }
+
+            alignment.emplace_back(next_i == i ? -1 : static_cast<int32_t>(node->id),
+                next_j == j ? -1 : static_cast<int32_t>(j - 1));
+            i = next_i;
+            j = next_j;
+        }
+
+        if (!is_on_edge || is_full) {
+            std::reverse(alignment.begin(), alignment.end());
+            return alignment;
+        }
+        band_width *= 2;
+    }
+}
+
+Window createWindow(uint64_t id, uint32_t rank, WindowType type, Layer* layers,
+    uint32_t num_layers) {
+
+    if (num_layers == 0 || layers[0].sequence_length == 0 ||
+        layers[0].sequence_begin + layers[0].sequence_length >
+        layers[0].sequence->length()) {
         fprintf(stderr, "[racon::createWindow] error: "
-            "empty backbone sequence/unequal quality length!\n");
+            "empty backbone sequence/invalid backbone range!\n");
         exit(1);
     }
 
-    return std::shared_ptr<Window>(new Window(id, rank, type, backbone,
-        backbone_length, quality, quality_length));
-}
+    for (uint32_t i = 1; i < num_layers; ++i) {
+        const auto& it = layers[i];
+        if (it.sequence_length == 0 ||
+            it.sequence_begin + it.sequence_length > it.sequence->length()) {
+            fprintf(stderr, "[racon::createWindow] error: "
+                "layer is out of sequence bounds!\n");
+            exit(1);
+        }
+        if (it.begin >= it.end || it.end > layers[0].sequence_length) {
+            fprintf(stderr, "[racon::createWindow] error: "
+                "layer begin and end positions are invalid!\n");
+            exit(1);
+        }
+    }
 
-Window::Window(uint64_t id, uint32_t rank, WindowType type, const char* backbone,
-    uint32_t backbone_length, const char* quality, uint32_t quality_length)
-        : id_(id), rank_(rank), type_(type), consensus_(), sequences_(),
-        qualities_(), positions_() {
+    return Window(id, rank, type, layers, num_layers);
+}
 
-    sequences_.emplace_back(backbone, backbone_length);
-    qualities_.emplace_back(quality, quality_length);
-    positions_.emplace_back(0, 0);
+Window::Window(uint64_t id, uint32_t rank, WindowType type, Layer* layers,
+    uint32_t num_layers)
+        : id_(id), rank_(rank), type_(type), consensus_(),
+        is_backbone_kept_(false), layers_(layers), num_layers_(num_layers) {
 }
 
 Window::~Window() {
 }
 
-void Window::add_layer(const char* sequence, uint32_t sequence_length,
-    const char* quality, uint32_t quality_length, uint32_t begin, uint32_t end) {
+uint64_t Window::cost() const {
+    uint64_t total_length = 0;
+    for (uint32_t i = 0; i < num_layers_; ++i) {
+        total_length += layers_[i].sequence_length;
+    }
+    return num_layers_ * total_length;
+}
+
+void Window::reduce_layers(uint32_t max_depth) {
 
-    if (sequence_length == 0 || begin == end) {
+    if (depth() <= max_depth) {
         return;
     }
 
-    if (quality != nullptr && sequence_length != quality_length) {
-        fprintf(stderr, "[racon::Window::add_layer] error: "
-            "unequal quality size!\n");
-        exit(1);
+    std::vector<uint32_t> rank;
+    rank.reserve(depth());
+    for (uint32_t i = 1; i < num_layers_; ++i) {
+        rank.emplace_back(i);
     }
-    if (begin >= end || begin > sequences_.front().second || end > sequences_.front().second) {
-        fprintf(stderr, "[racon::Window::add_layer] error: "
-            "layer begin and end positions are invalid!\n");
-        exit(1);
+    std::stable_sort(rank.begin(), rank.end(), [&](uint32_t lhs, uint32_t rhs) {
+        return layers_[lhs].score > layers_[rhs].score; });
+    rank.resize(max_depth);
+    std::sort(rank.begin(), rank.end());
+
+    // the backbone stays in front, kept layers are compacted in place
+    uint32_t i = 1;
+    for (const auto& it: rank) {
+        layers_[i++] = layers_[it];
+    }
+    num_layers_ = i;
+}
+
+void Window::clear_consensus() {
+    std::string().swap(consensus_);
+}
+
+void Window::decode_layers(std::string& data, std::string& quality,
+    std::vector<std::pair<const char*, uint32_t>>& sequences,
+    std::vector<std::pair<const char*, uint32_t>>& qualities) const {
+
+    uint64_t total_length = 0;
+    for (uint32_t i = 0; i < num_layers_; ++i) {
+        total_length += layers_[i].sequence_length;
+    }
+    data.resize(total_length);
+    quality.resize(total_length);
+
+    sequences.clear();
+    qualities.clear();
+
+    for (uint32_t i = 0, offset = 0; i < num_layers_; ++i) {
+        const auto& layer = layers_[i];
+        uint32_t length = layer.sequence_length;
+        layer.sequence->decode_data(layer.sequence_begin, length, layer.strand,
+            &data[offset]);
+        sequences.emplace_back(nullptr, length);
+
+        if (!layer.sequence->quality().empty()) {
+            layer.sequence->decode_quality(layer.sequence_begin, length,
+                layer.strand, &quality[offset]);
+            qualities.emplace_back(nullptr, length);
+        } else if (i == 0) {
+            std::fill(&quality[offset], &quality[offset] + length, '!');
+            qualities.emplace_back(nullptr, length);
+        } else {
+            qualities.emplace_back(nullptr, 0);
+        }
+        offset += length;
     }
 
-    sequences_.emplace_back(sequence, sequence_length);
-    qualities_.emplace_back(quality, quality_length);
-    positions_.emplace_back(begin, end);
+    // buffers are not reallocated anymore, safe to point into them
+    for (uint32_t i = 0, offset = 0; i < sequences.size(); ++i) {
+        sequences[i].first = &data[offset];
+        if (qualities[i].second != 0) {
+            qualities[i].first = &quality[offset];
+        }
+        offset += sequences[i].second;
+    }
 }
 
 bool Window::generate_consensus(std::shared_ptr<spoa::AlignmentEngine> alignment_engine,
-    bool trim) {
+    std::shared_ptr<ConsensusContext> context, bool trim) {
+
+    auto& sequences = context->sequences;
+    auto& qualities = context->qualities;
+    decode_layers(context->data, context->quality, sequences, qualities);
 
-    if (sequences_.size() < 3) {
-        consensus_ = std::string(sequences_.front().first, sequences_.front().second);
+    if (sequences.size() < 3) {
+        consensus_ = std::string(sequences.front().first, sequences.front().second);
         return false;
     }
 
-    spoa::Graph graph{};
+    uint32_t offset = 0.01 * sequences.front().second;
+
+    // layers which already agree with the backbone would not change it
+    if (context->agreement_threshold > 0 && backboneAgreement(sequences,
+        layers_, offset, *context) >= context->agreement_threshold) {
+        consensus_ = std::string(sequences.front().first, sequences.front().second);
+        is_backbone_kept_ = true;
+        return true;
+    }
+
+    // nodes of the previous window are freed but buffers keep their capacity
+    auto& graph = context->graph;
+    graph.Clear();
     graph.AddAlignment(
         spoa::Alignment(),
-        sequences_.front().first, sequences_.front().second,
-        qualities_.front().first, qualities_.front().second);
+        sequences.front().first, sequences.front().second,
+        qualities.front().first, qualities.front().second);
 
-    std::vector<uint32_t> rank;
-    rank.reserve(sequences_.size());
-    for (uint32_t i = 0; i < sequences_.size(); ++i) {
+    auto& rank = context->rank;
+    rank.clear();
+    for (uint32_t i = 0; i < sequences.size(); ++i) {
         rank.emplace_back(i);
     }
 
     std::sort(rank.begin() + 1, rank.end(), [&](uint32_t lhs, uint32_t rhs) {
-        return positions_[lhs].first < positions_[rhs].first; });
+        return layers_[lhs].begin < layers_[rhs].begin; });
 
-    uint32_t offset = 0.01 * sequences_.front().second;
-    for (uint32_t j = 1; j < sequences_.size(); ++j) {
+    for (uint32_t j = 1; j < sequences.size(); ++j) {
         uint32_t i = rank[j];
 
+        auto align = [&] (const spoa::Graph& target) -> spoa::Alignment {
+            if (context->band_width > 0) {
+                return alignBanded(sequences[i].first, sequences[i].second,
+                    target, *context);
+            }
+            return alignment_engine->Align(sequences[i].first,
+                sequences[i].second, target);
+        };
+
         spoa::Alignment alignment;
-        if (positions_[i].first < offset && positions_[i].second >
-            sequences_.front().second - offset) {
-            alignment = alignment_engine->Align(
-                sequences_[i].first, sequences_[i].second,
-                graph);
+        if (layers_[i].begin < offset && layers_[i].end >
+            sequences.front().second - offset) {
+            alignment = align(graph);
         } else {
-            std::vector<const spoa::Graph::Node*> mapping;
+            auto& mapping = context->mapping;
+            mapping.clear();
             auto subgraph = graph.Subgraph(
-                positions_[i].first,
-                positions_[i].second,
+                layers_[i].begin,
+                layers_[i].end,
                 &mapping);
-            alignment = alignment_engine->Align(
-                sequences_[i].first, sequences_[i].second,
-                subgraph);
+            alignment = align(subgraph);
             subgraph.UpdateAlignment(mapping, &alignment);
         }
 
-        if (qualities_[i].first == nullptr) {
+        if (qualities[i].first == nullptr) {
             graph.AddAlignment(
                 alignment,
-                sequences_[i].first, sequences_[i].second);
+                sequences[i].first, sequences[i].second);
         } else {
             graph.AddAlignment(
                 alignment,
-                sequences_[i].first, sequences_[i].second,
-                qualities_[i].first, qualities_[i].second);
+                sequences[i].first, sequences[i].second,
+                qualities[i].first, qualities[i].second);
         }
     }
 
-    std::vector<uint32_t> coverages;
+    auto& coverages = context->coverages;
+    coverages.clear();
     consensus_ = graph.GenerateConsensus(&coverages);
 
     if (type_ == WindowType::kTGS && trim) {
-        uint32_t average_coverage = (sequences_.size() - 1) / 2;
+        uint32_t average_coverage = (sequences.size() - 1) / 2;
 
         int32_t begin = 0, end = consensus_.size() - 1;
         for (; begin < static_cast<int32_t>(consensus_.size()); ++begin) {
@@ -7,6 +7,7 @@
 #pragma once
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <vector>
 #include <memory>
 #include <string>
@@ -18,21 +19,60 @@ namespace spoa {
 
 namespace racon {
 
+class Sequence;
+
 enum class WindowType {
     kNGS, // Next Generation Sequencing
     kTGS // Third Generation Sequencing
 };
 
+/*!
+ * @brief Per thread state of consensus generation (POA graph and scratch
+ * buffers) which is cleared and reused across windows instead of being
+ * allocated anew for each of them, layers are aligned to the graph within a
+ * band around their expected diagonal if band_width is not 0 (scores have to
+ * be equal to those of the alignment engine), windows whose backbone is
+ * supported by and agrees with their layers are left unchanged if
+ * agreement_threshold is not 0 (see --agreement-threshold)
+ */
+struct ConsensusContext;
+std::shared_ptr<ConsensusContext> createConsensusContext(int8_t match,
+    int8_t mismatch, int8_t gap, uint32_t band_width,
+    double agreement_threshold);
+
+/*!
+ * @brief Bases [sequence_begin, sequence_begin + sequence_length) of the
+ * sequence on the given strand which span backbone positions [begin, end] of
+ * a window, score ranks the layer in reduce_layers (the first layer of each
+ * window is its backbone), bases are decoded only once consensus is generated
+ */
+struct Layer {
+    const Sequence* sequence;
+    uint32_t strand;
+    uint32_t sequence_begin;
+    uint32_t sequence_length;
+    uint32_t begin;
+    uint32_t end;
+    float score;
+};
+
+/*!
+ * @brief Layers of all windows are stored in one array grouped by window,
+ * a window refers to its num_layers layers starting at layers (which have to
+ * outlive it)
+ */
 class Window;
-std::shared_ptr<Window> createWindow(uint64_t id, uint32_t rank, WindowType type,
-    const char* backbone, uint32_t backbone_length, const char* quality,
-    uint32_t quality_length);
+Window createWindow(uint64_t id, uint32_t rank, WindowType type, Layer* layers,
+    uint32_t num_layers);
 
 class Window {
 
 public:
     ~Window();
 
+    Window(Window&&) = default;
+    Window& operator=(Window&&) = default;
+
     uint64_t id() const {
         return id_;
     }
@@ -44,33 +84,67 @@ public:
         return consensus_;
     }
 
+    // true if POA was skipped and the backbone kept as the consensus as the
+    // layers agree with it (see --agreement-threshold)
+    bool is_backbone_kept() const {
+        return is_backbone_kept_;
+    }
+
+    // number of layers without the backbone
+    uint32_t depth() const {
+        return num_layers_ - 1;
+    }
+
+    /*!
+     * @brief Returns the estimated cost of generate_consensus() (number of
+     * layers times their total length)
+     */
+    uint64_t cost() const;
+
+    /*!
+     * @brief Context has to be exclusive to the calling thread (same as the
+     * alignment engine)
+     */
     bool generate_consensus(std::shared_ptr<spoa::AlignmentEngine> alignment_engine,
-        bool trim);
+        std::shared_ptr<ConsensusContext> context, bool trim);
 
-    void add_layer(const char* sequence, uint32_t sequence_length,
-        const char* quality, uint32_t quality_length, uint32_t begin,
-        uint32_t end);
+    /*!
+     * @brief Keeps only max_depth layers with the highest scores (in the
+     * order in which they were added)
+     */
+    void reduce_layers(uint32_t max_depth);
 
-    friend std::shared_ptr<Window> createWindow(uint64_t id, uint32_t rank,
-        WindowType type, const char* backbone, uint32_t backbone_length,
-        const char* quality, uint32_t quality_length);
+    // frees the consensus once it has been collected
+    void clear_consensus();
+
+    friend Window createWindow(uint64_t id, uint32_t rank, WindowType type,
+        Layer* layers, uint32_t num_layers);
 
 #ifdef CUDA_ENABLED
     friend class CUDABatchProcessor;
 #endif
 private:
-    Window(uint64_t id, uint32_t rank, WindowType type, const char* backbone,
-        uint32_t backbone_length, const char* quality, uint32_t quality_length);
+    Window(uint64_t id, uint32_t rank, WindowType type, Layer* layers,
+        uint32_t num_layers);
     Window(const Window&) = delete;
     const Window& operator=(const Window&) = delete;
 
+    /*!
+     * @brief Decodes all layers into data and quality and stores their
+     * locations into sequences and qualities (quality is nullptr for layers
+     * without one, backbone without quality gets a dummy one)
+     */
+    void decode_layers(std::string& data, std::string& quality,
+        std::vector<std::pair<const char*, uint32_t>>& sequences,
+        std::vector<std::pair<const char*, uint32_t>>& qualities) const;
+
     uint64_t id_;
     uint32_t rank_;
     WindowType type_;
     std::string consensus_;
-    std::vector<std::pair<const char*, uint32_t>> sequences_;
-    std::vector<std::pair<const char*, uint32_t>> qualities_;
-    std::vector<std::pair<uint32_t, uint32_t>> positions_;
+    bool is_backbone_kept_;
+    Layer* layers_;
+    uint32_t num_layers_;
 };
 
 }
@@ -5,6 +5,11 @@
  */
 
 #include "sequence.hpp"
+#include "sequence_writer.hpp"
+#include "name_index.hpp"
+#include "cigar.hpp"
+#include "overlap.hpp"
+#include "paf_parser.hpp"
 #include "polisher.hpp"
 
 #include "edlib.h"
@@ -28,11 +33,17 @@ public:
         const std::string& target_path, racon::PolisherType type,
         uint32_t window_length, double quality_threshold, double error_threshold,
         int8_t match, int8_t mismatch, int8_t gap, uint32_t cuda_batches = 0,
-        bool cuda_banded_alignment = false, uint32_t cudaaligner_batches = 0) {
+        bool cuda_banded_alignment = false, uint32_t cudaaligner_batches = 0,
+        uint64_t split_size = 0, const std::string& cache_path = "",
+        bool lazy_loading = false, uint32_t shard = 0, uint32_t num_shards = 1,
+        bool target_sorted = false, int32_t max_depth = 0,
+        uint32_t poa_band_width = 0, double agreement_threshold = 0) {
 
         polisher = racon::createPolisher(sequences_path, overlaps_path, target_path,
             type, window_length, quality_threshold, error_threshold, true, match,
-            mismatch, gap, 4, cuda_batches, cuda_banded_alignment, cudaaligner_batches);
+            mismatch, gap, 4, cuda_batches, cuda_banded_alignment, cudaaligner_batches,
+            0, split_size, cache_path, lazy_loading, shard, num_shards,
+            target_sorted, max_depth, poa_band_width, agreement_threshold);
     }
 
     void TearDown() {}
@@ -61,18 +72,44 @@ TEST(RaconInitializeTest, WindowLengthError) {
         0, 0, 0, 0, 0, 0, 0)), ".racon::createPolisher. error: invalid window length!");
 }
 
-TEST(RaconInitializeTest, SequencesPathExtensionError) {
+TEST(RaconInitializeTest, ShardError) {
     EXPECT_DEATH((racon::createPolisher("", "", "", racon::PolisherType::kC, 500,
-        0, 0, 0, 0, 0, 0, 0)), ".racon::createPolisher. error: file  has unsupported "
+        0, 0, 0, 0, 0, 0, 0, 0, false, 0, 0, 0, "", false, 2, 2)),
+        ".racon::createPolisher. error: invalid shard!");
+}
+
+TEST(RaconInitializeTest, MaxDepthError) {
+    EXPECT_DEATH((racon::createPolisher("", "", "", racon::PolisherType::kC, 500,
+        0, 0, 0, 0, 0, 0, 0, 0, false, 0, 0, 0, "", false, 0, 1, false, -2)),
+        ".racon::createPolisher. error: invalid maximum depth!");
+}
+
+TEST(RaconInitializeTest, AgreementThresholdError) {
+    EXPECT_DEATH((racon::createPolisher("", "", "", racon::PolisherType::kC, 500,
+        0, 0, 0, 0, 0, 0, 0, 0, false, 0, 0, 0, "", false, 0, 1, false, 0, 0,
+        1.5)), ".racon::createPolisher. error: invalid agreement threshold!");
+}
+
+TEST(RaconInitializeTest, SequencesPathExtensionError) {
+    EXPECT_DEATH((racon::createPolisher("sequences.txt", "", "",
+        racon::PolisherType::kC, 500, 0, 0, 0, 0, 0, 0, 0)),
+        ".racon::createPolisher. error: file sequences.txt has unsupported "
         "format extension .valid extensions: .fasta, .fasta.gz, .fna, .fna.gz, "
         ".fa, .fa.gz, .fastq, .fastq.gz, .fq, .fq.gz.!");
 }
 
+TEST(RaconInitializeTest, MissingSequencesError) {
+    EXPECT_DEATH((racon::createPolisher("", std::string(TEST_DATA) +
+        "sample_overlaps.paf.gz", "", racon::PolisherType::kC, 500, 0, 0, 0, 0,
+        0, 0, 0)), ".racon::createPolisher. error: missing sequences for "
+        "overlaps which are not in SAM/BAM format!");
+}
+
 TEST(RaconInitializeTest, OverlapsPathExtensionError) {
     EXPECT_DEATH((racon::createPolisher(std::string(TEST_DATA) + "sample_reads.fastq.gz",
         "", "", racon::PolisherType::kC, 500, 0, 0, 0, 0, 0, 0, 0)),
         ".racon::createPolisher. error: file  has unsupported format extension "
-        ".valid extensions: .mhap, .mhap.gz, .paf, .paf.gz, .sam, .sam.gz.!");
+        ".valid extensions: .mhap, .mhap.gz, .paf, .paf.gz, .sam, .sam.gz, .bam.!");
 }
 
 TEST(RaconInitializeTest, TargetPathExtensionError) {
@@ -83,6 +120,326 @@ TEST(RaconInitializeTest, TargetPathExtensionError) {
         ".fna.gz, .fa, .fa.gz, .fastq, .fastq.gz, .fq, .fq.gz.!");
 }
 
+TEST(RaconSequenceTest, PackedDecode) {
+    std::string data = "ACGTNNNNACGGTTRYCAGTACGTACGTACGTACGTACGTTTGCANACGTAC";
+    std::string reverse_complement = "GTACGTNTGCAAACGTACGTACGTACGTACGTACTGYRAACCGTNNNNACGT";
+
+    auto sequence = racon::createSequence("packed", data);
+    sequence->transmute(true, true);
+    EXPECT_TRUE(sequence->data().empty());
+    EXPECT_EQ(sequence->length(), data.size());
+
+    std::string decoded(data.size(), '\0');
+    sequence->decode_data(0, data.size(), 0, &decoded[0]);
+    EXPECT_EQ(decoded, data);
+    sequence->decode_data(0, data.size(), 1, &decoded[0]);
+    EXPECT_EQ(decoded, reverse_complement);
+
+    for (uint32_t i = 0; i < data.size(); i += 7) {
+        uint32_t length = i + 11 > data.size() ? data.size() - i : 11;
+        decoded.resize(length);
+        sequence->decode_data(i, length, 0, &decoded[0]);
+        EXPECT_EQ(decoded, data.substr(i, length));
+        sequence->decode_data(i, length, 1, &decoded[0]);
+        EXPECT_EQ(decoded, reverse_complement.substr(i, length));
+    }
+
+    sequence->create_reverse_complement();
+    EXPECT_EQ(sequence->reverse_complement(), reverse_complement);
+}
+
+TEST(RaconSequenceTest, ReverseStrandRecord) {
+    auto sequence = racon::createSequence("record", "AACGTN", 6, "!#%')+", 6, 1);
+    EXPECT_EQ(sequence->data(), "NACGTT");
+    EXPECT_EQ(sequence->quality(), "+)'%#!");
+    EXPECT_TRUE(sequence->reverse_complement().empty());
+
+    // qualities which are all zero are dropped
+    sequence = racon::createSequence("record", "AACGTN", 6, "!!!!!!", 6, 0);
+    EXPECT_EQ(sequence->data(), "AACGTN");
+    EXPECT_TRUE(sequence->quality().empty());
+}
+
+TEST(RaconNameIndexTest, InsertAndFind) {
+    racon::NameIndex name_index;
+
+    uint64_t id = 0;
+    EXPECT_FALSE(name_index.find("read", 4, racon::NameRole::kQuery, id));
+
+    for (uint64_t i = 0; i < 10000; ++i) {
+        std::string name = "read_" + std::to_string(i);
+        name_index.insert(name.c_str(), name.size(), racon::NameRole::kQuery, i);
+        if (i % 3 == 0) {
+            name_index.insert(name.c_str(), name.size(), racon::NameRole::kTarget,
+                i / 3);
+        }
+    }
+    EXPECT_EQ(name_index.size(), 13334);
+
+    for (uint64_t i = 0; i < 10000; ++i) {
+        std::string name = "read_" + std::to_string(i);
+        EXPECT_TRUE(name_index.find(name.c_str(), name.size(),
+            racon::NameRole::kQuery, id));
+        EXPECT_EQ(id, i);
+        EXPECT_EQ(name_index.find(name.c_str(), name.size(),
+            racon::NameRole::kTarget, id), i % 3 == 0);
+    }
+    EXPECT_FALSE(name_index.find("read_1", 5, racon::NameRole::kQuery, id));
+    EXPECT_FALSE(name_index.find("read_10000", 10, racon::NameRole::kQuery, id));
+
+    name_index.insert("read_42", 7, racon::NameRole::kQuery, 7);
+    EXPECT_TRUE(name_index.find("read_42", 7, racon::NameRole::kQuery, id));
+    EXPECT_EQ(id, 7);
+    EXPECT_EQ(name_index.size(), 13334);
+
+    // precomputed hashes address the same entries
+    name_index.insert("read_43", 7, racon::hashName("read_43", 7),
+        racon::NameRole::kQuery, 8);
+    EXPECT_TRUE(name_index.find("read_43", 7, racon::NameRole::kQuery, id));
+    EXPECT_EQ(id, 8);
+    EXPECT_TRUE(name_index.find("read_42", 7, racon::hashName("read_42", 7),
+        racon::NameRole::kQuery, id));
+    EXPECT_EQ(id, 7);
+    EXPECT_EQ(name_index.size(), 13334);
+
+    name_index.clear();
+    EXPECT_FALSE(name_index.find("read_42", 7, racon::NameRole::kQuery, id));
+}
+
+TEST(RaconCigarTest, ParseAndConvert) {
+    std::vector<uint32_t> cigar;
+    EXPECT_TRUE(racon::parseCigar("12S105M2I3D1N7=4X5H", 19, cigar));
+    EXPECT_EQ(cigar.size(), 8);
+
+    std::string text;
+    uint32_t q_length = 0, t_length = 0;
+    for (const auto& it: cigar) {
+        text += std::to_string(racon::cigarLength(it));
+        text += racon::cigarOperationChar(racon::cigarOperation(it));
+        if (racon::consumesQuery(racon::cigarOperation(it))) {
+            q_length += racon::cigarLength(it);
+        }
+        if (racon::consumesTarget(racon::cigarOperation(it))) {
+            t_length += racon::cigarLength(it);
+        }
+    }
+    EXPECT_EQ(text, "12S105M2I3D1N7=4X5H");
+    EXPECT_EQ(q_length, 130);
+    EXPECT_EQ(t_length, 120);
+
+    EXPECT_FALSE(racon::parseCigar("*", 1, cigar));
+    EXPECT_FALSE(racon::parseCigar("M", 1, cigar));
+    EXPECT_FALSE(racon::parseCigar("10M5", 4, cigar));
+
+    const unsigned char alignment[] = { 0, 0, 3, 0, 1, 1, 2, 0 };
+    racon::alignmentToCigar(alignment, 8, cigar);
+    EXPECT_EQ(cigar, std::vector<uint32_t>({ racon::packCigar(4, racon::kCigarMatch),
+        racon::packCigar(2, racon::kCigarInsertion),
+        racon::packCigar(1, racon::kCigarDeletion),
+        racon::packCigar(1, racon::kCigarMatch) }));
+}
+
+TEST(RaconCigarTest, ParseCs) {
+    std::vector<uint32_t> cigar;
+    const std::string cs = ":10*ag:5+acg-tt~gt100ag=ACGT*ct";
+    EXPECT_TRUE(racon::parseCs(cs.c_str(), cs.size(), cigar));
+    EXPECT_EQ(cigar, std::vector<uint32_t>({ racon::packCigar(16, racon::kCigarMatch),
+        racon::packCigar(3, racon::kCigarInsertion),
+        racon::packCigar(2, racon::kCigarDeletion),
+        racon::packCigar(100, racon::kCigarSkip),
+        racon::packCigar(5, racon::kCigarMatch) }));
+
+    EXPECT_FALSE(racon::parseCs(":", 1, cigar));
+    EXPECT_FALSE(racon::parseCs("*a", 2, cigar));
+    EXPECT_FALSE(racon::parseCs("10", 2, cigar));
+    EXPECT_FALSE(racon::parseCs("~gt10a", 6, cigar));
+}
+
+TEST(RaconOverlapTest, DualBreakingPoints) {
+    // b is a with a few substitutions and an inserted base, breaking points
+    // of b to a derived from the alignment of a to b have to equal those of
+    // aligning b to a directly
+    std::string a;
+    for (uint32_t i = 0, x = 42; i < 1000; ++i) {
+        x = x * 1103515245 + 12345;
+        a += "ACGT"[(x >> 16) & 3];
+    }
+    std::string b = a.substr(0, 500);
+    for (const auto& it: std::string("ACGT")) {
+        if (it != a[499] && it != a[500]) {
+            b += it;
+            break;
+        }
+    }
+    b += a.substr(500);
+    for (const auto& it: {100, 300, 700}) {
+        b[it] = b[it] == 'A' ? 'C' : 'A';
+    }
+
+    std::string path = ::testing::TempDir() + "racon_test_dual.paf";
+    const char* strands[] = {"+", "-", "+"};
+    const char* tags[][2] = {{"", ""}, {"", ""},
+        {"\tcg:Z:450M1D450M", "\tcg:Z:450M1I450M"}};
+    for (uint32_t i = 0; i < 3; ++i) {
+        bool strand = strands[i][0] == '-';
+        std::string t = b;
+        if (strand) {
+            auto sequence = racon::createSequence("b", b.c_str(), b.size(),
+                nullptr, 0, 1);
+            t = sequence->data();
+        }
+        std::string t_range = strand ? std::to_string(b.size() - 951) + "\t" +
+            std::to_string(b.size() - 50) : "50\t951";
+
+        FILE* file = fopen(path.c_str(), "w");
+        fprintf(file, "a\t1000\t50\t950\t%s\tb\t1001\t%s\t900\t901\t60%s\n",
+            strands[i], t_range.c_str(), tags[i][0]);
+        fprintf(file, "b\t1001\t%s\t%s\ta\t1000\t50\t950\t900\t901\t60%s\n",
+            t_range.c_str(), strands[i], tags[i][1]);
+        fclose(file);
+
+        std::vector<std::unique_ptr<racon::Sequence>> sequences;
+        sequences.emplace_back(racon::createSequence("a", a));
+        sequences.emplace_back(racon::createSequence("b", t));
+        racon::NameIndex name_index;
+        for (uint64_t j = 0; j < sequences.size(); ++j) {
+            sequences[j]->transmute(true, true);
+            name_index.insert(sequences[j]->name().c_str(),
+                sequences[j]->name().size(), racon::NameRole::kQuery, j);
+            name_index.insert(sequences[j]->name().c_str(),
+                sequences[j]->name().size(), racon::NameRole::kTarget, j);
+        }
+
+        auto parser = racon::createPafParser(path);
+        auto overlaps = parser->parse(-1, nullptr);
+        parser->reset();
+        auto direct = parser->parse(-1, nullptr);
+        ASSERT_EQ(overlaps.size(), 2);
+        ASSERT_EQ(direct.size(), 2);
+        for (const auto& it: {&overlaps, &direct}) {
+            for (const auto& jt: *it) {
+                jt->transmute(sequences, name_index, {}, 2);
+            }
+        }
+        EXPECT_TRUE(overlaps[0]->is_dual(*overlaps[1]));
+
+        overlaps[0]->find_breaking_points(sequences, 100, 0.3, overlaps[1].get());
+        direct[1]->find_breaking_points(sequences, 100, 0.3);
+
+        EXPECT_FALSE(overlaps[1]->breaking_points().empty());
+        EXPECT_EQ(overlaps[1]->breaking_points(), direct[1]->breaking_points());
+        EXPECT_TRUE(overlaps[1]->cigar().empty());
+    }
+
+    remove(path.c_str());
+}
+
+TEST(RaconOverlapTest, AnchoredBreakingPoints) {
+    // the read is the target with spaced substitutions and single base
+    // indels, breaking points of the alignment between anchors have to equal
+    // those of the global alignment (given as cg:Z)
+    std::string t;
+    for (uint32_t i = 0, x = 7; i < 30000; ++i) {
+        x = x * 1103515245 + 12345;
+        t += "ACGT"[(x >> 16) & 3];
+    }
+    std::string q;
+    for (uint32_t i = 0; i < t.size(); ++i) {
+        if (i % 1000 == 150) {
+            for (const auto& it: std::string("ACGT")) {
+                if (it != t[i - 1] && it != t[i]) {
+                    q += it;
+                    break;
+                }
+            }
+        } else if (i % 1000 == 700 && t[i] != t[i - 1] && t[i] != t[i + 1]) {
+            continue;
+        }
+        q += i % 100 == 50 ? (t[i] == 'A' ? 'C' : 'A') : t[i];
+    }
+
+    // a copy of the read with a junk region holding a target k-mer 500 bases
+    // off the diagonal, which must not be used as an anchor
+    std::string junk = q;
+    for (uint32_t i = 4000, x = 13; i < 4600; ++i) {
+        x = x * 1103515245 + 12345;
+        junk[i] = "ACGT"[(x >> 16) & 3];
+    }
+    junk.replace(4050, 15, t.substr(4550, 15));
+
+    std::string path = ::testing::TempDir() + "racon_test_anchored.paf";
+    for (const auto& read: {q, junk}) {
+        EdlibAlignResult result = edlibAlign(read.c_str(), read.size(),
+            t.c_str(), t.size(), edlibNewAlignConfig(-1, EDLIB_MODE_NW,
+                EDLIB_TASK_PATH, nullptr, 0));
+        char* cigar = edlibAlignmentToCigar(result.alignment,
+            result.alignmentLength, EDLIB_CIGAR_STANDARD);
+
+        FILE* file = fopen(path.c_str(), "w");
+        fprintf(file, "q\t%zu\t0\t%zu\t+\tt\t%zu\t0\t%zu\t%zu\t%zu\t60\n",
+            read.size(), read.size(), t.size(), t.size(), t.size(), t.size());
+        fprintf(file, "q\t%zu\t0\t%zu\t+\tt\t%zu\t0\t%zu\t%zu\t%zu\t60"
+            "\tcg:Z:%s\n", read.size(), read.size(), t.size(), t.size(),
+            t.size(), t.size(), cigar);
+        fclose(file);
+        free(cigar);
+        edlibFreeAlignResult(result);
+
+        std::vector<std::unique_ptr<racon::Sequence>> sequences;
+        sequences.emplace_back(racon::createSequence("q", read));
+        sequences.emplace_back(racon::createSequence("t", t));
+        racon::NameIndex name_index;
+        for (uint64_t j = 0; j < sequences.size(); ++j) {
+            sequences[j]->transmute(true, true);
+            name_index.insert(sequences[j]->name().c_str(),
+                sequences[j]->name().size(), j == 0 ? racon::NameRole::kQuery :
+                racon::NameRole::kTarget, j);
+        }
+
+        auto parser = racon::createPafParser(path);
+        auto overlaps = parser->parse(-1, nullptr);
+        ASSERT_EQ(overlaps.size(), 2);
+        for (const auto& it: overlaps) {
+            it->transmute(sequences, name_index, {}, 2);
+            it->find_breaking_points(sequences, 500, 0.02);
+        }
+
+        EXPECT_FALSE(overlaps[0]->breaking_points().empty());
+        if (read == q) {
+            EXPECT_EQ(overlaps[0]->breaking_points(), overlaps[1]->breaking_points());
+        }
+    }
+
+    remove(path.c_str());
+}
+
+TEST(RaconSequenceWriterTest, CompressedLineWrap) {
+    std::string path = ::testing::TempDir() + "racon_test_writer.fasta.gz";
+
+    // the second sequence spans several compressed blocks
+    std::vector<std::string> data = {"ACGT", std::string()};
+    for (uint32_t i = 0; i < 200000; ++i) {
+        data[1] += "ACGT"[(i * 7919) % 13 % 4];
+    }
+
+    auto writer = racon::createSequenceWriter(path, 60);
+    for (uint32_t i = 0; i < data.size(); ++i) {
+        writer->write(racon::createSequence("seq_" + std::to_string(i), data[i]));
+    }
+    writer->close();
+
+    auto parser = bioparser::Parser<racon::Sequence>::Create<bioparser::FastaParser>(
+        path);
+    auto sequences = parser->Parse(-1);
+    EXPECT_EQ(sequences.size(), 2);
+    for (uint32_t i = 0; i < sequences.size(); ++i) {
+        EXPECT_EQ(sequences[i]->name(), "seq_" + std::to_string(i));
+        EXPECT_EQ(sequences[i]->data(), data[i]);
+    }
+
+    remove(path.c_str());
+}
+
 TEST_F(RaconPolishingTest, ConsensusWithQualities) {
     SetUp(std::string(TEST_DATA) + "sample_reads.fastq.gz", std::string(TEST_DATA) +
         "sample_overlaps.paf.gz", std::string(TEST_DATA) + "sample_layout.fasta.gz",
@@ -153,6 +510,88 @@ TEST_F(RaconPolishingTest, ConsensusWithQualitiesAndAlignments) {
         reference[0]->data()));
 }
 
+TEST_F(RaconPolishingTest, ConsensusWithQualitiesAndAlignmentsBam) {
+    SetUp(std::string(TEST_DATA) + "sample_reads.fastq.gz", std::string(TEST_DATA) +
+        "sample_overlaps.bam", std::string(TEST_DATA) + "sample_layout.fasta.gz",
+        racon::PolisherType::kC, 500, 10, 0.3, 5, -4, -8);
+
+    initialize();
+
+    std::vector<std::unique_ptr<racon::Sequence>> polished_sequences;
+    polish(polished_sequences, true);
+    EXPECT_EQ(polished_sequences.size(), 1);
+
+    polished_sequences[0]->create_reverse_complement();
+
+    auto parser = bioparser::Parser<racon::Sequence>::Create<bioparser::FastaParser>(
+        std::string(TEST_DATA) + "sample_reference.fasta.gz");
+    auto reference = parser->Parse(-1);
+    EXPECT_EQ(reference.size(), 1);
+
+    EXPECT_EQ(1317, calculateEditDistance(
+        polished_sequences[0]->reverse_complement(),
+        reference[0]->data()));
+}
+
+TEST_F(RaconPolishingTest, ConsensusWithQualitiesAndAlignmentsWithoutSequences) {
+    auto parser = bioparser::Parser<racon::Sequence>::Create<bioparser::FastaParser>(
+        std::string(TEST_DATA) + "sample_reference.fasta.gz");
+    auto reference = parser->Parse(-1);
+    EXPECT_EQ(reference.size(), 1);
+
+    // reads are taken from primary records only, secondary and supplementary
+    // ones (74 out of 255) lack parts of their reads and are ignored which is
+    // why the consensus is worse than with sample_reads.fastq.gz (the layout
+    // is 8765 edits away from the reference)
+    const char* overlaps_paths[] = {"sample_overlaps.sam.gz", "sample_overlaps.bam"};
+    std::string consensuses[2];
+    for (uint32_t i = 0; i < 2; ++i) {
+        SetUp("", std::string(TEST_DATA) + overlaps_paths[i],
+            std::string(TEST_DATA) + "sample_layout.fasta.gz",
+            racon::PolisherType::kC, 500, 10, 0.3, 5, -4, -8);
+
+        initialize();
+
+        std::vector<std::unique_ptr<racon::Sequence>> polished_sequences;
+        polish(polished_sequences, true);
+        EXPECT_EQ(polished_sequences.size(), 1);
+
+        consensuses[i] = polished_sequences[0]->data();
+
+        polished_sequences[0]->create_reverse_complement();
+        uint32_t edit_distance = calculateEditDistance(
+            polished_sequences[0]->reverse_complement(), reference[0]->data());
+        EXPECT_GT(edit_distance, 1317);
+        EXPECT_LT(edit_distance, 1800);
+    }
+
+    EXPECT_EQ(consensuses[0], consensuses[1]);
+}
+
+TEST_F(RaconPolishingTest, ConsensusWithQualitiesAndAlignmentsPaf) {
+    // PAF with cg:Z tags converted from sample_overlaps.sam.gz
+    SetUp(std::string(TEST_DATA) + "sample_reads.fastq.gz", std::string(TEST_DATA) +
+        "sample_overlaps_cigar.paf.gz", std::string(TEST_DATA) + "sample_layout.fasta.gz",
+        racon::PolisherType::kC, 500, 10, 0.3, 5, -4, -8);
+
+    initialize();
+
+    std::vector<std::unique_ptr<racon::Sequence>> polished_sequences;
+    polish(polished_sequences, true);
+    EXPECT_EQ(polished_sequences.size(), 1);
+
+    polished_sequences[0]->create_reverse_complement();
+
+    auto parser = bioparser::Parser<racon::Sequence>::Create<bioparser::FastaParser>(
+        std::string(TEST_DATA) + "sample_reference.fasta.gz");
+    auto reference = parser->Parse(-1);
+    EXPECT_EQ(reference.size(), 1);
+
+    EXPECT_EQ(1317, calculateEditDistance(
+        polished_sequences[0]->reverse_complement(),
+        reference[0]->data()));
+}
+
 TEST_F(RaconPolishingTest, ConsensusWithoutQualitiesAndWithAlignments) {
     SetUp(std::string(TEST_DATA) + "sample_reads.fasta.gz", std::string(TEST_DATA) +
         "sample_overlaps.sam.gz", std::string(TEST_DATA) + "sample_layout.fasta.gz",
@@ -294,6 +733,358 @@ TEST_F(RaconPolishingTest, FragmentCorrectionWithQualitiesFullMhap) {
     EXPECT_EQ(total_length, 1658216);
 }
 
+TEST_F(RaconPolishingTest, FragmentCorrectionWithQualitiesFullSplit) {
+    SetUp(std::string(TEST_DATA) + "sample_reads.fastq.gz", std::string(TEST_DATA) +
+        "sample_ava_overlaps.paf.gz", std::string(TEST_DATA) + "sample_reads.fastq.gz",
+        racon::PolisherType::kF, 500, 10, 0.3, 1, -1, -1, 0, false, 0, 500000);
+
+    initialize();
+
+    std::vector<std::unique_ptr<racon::Sequence>> polished_sequences;
+    polish(polished_sequences, false);
+    EXPECT_EQ(polished_sequences.size(), 236);
+
+    uint32_t total_length = 0;
+    for (const auto& it : polished_sequences) {
+        total_length += it->data().size();
+    }
+    EXPECT_EQ(total_length, 1658216);
+}
+
+TEST_F(RaconPolishingTest, ConsensusWithQualitiesAndAlignmentsSplit) {
+    SetUp(std::string(TEST_DATA) + "sample_reads.fastq.gz", std::string(TEST_DATA) +
+        "sample_overlaps.sam.gz", std::string(TEST_DATA) + "sample_layout.fasta.gz",
+        racon::PolisherType::kC, 500, 10, 0.3, 5, -4, -8, 0, false, 0, 1);
+
+    initialize();
+
+    std::vector<std::unique_ptr<racon::Sequence>> polished_sequences;
+    polish(polished_sequences, true);
+    EXPECT_EQ(polished_sequences.size(), 1);
+
+    polished_sequences[0]->create_reverse_complement();
+
+    auto parser = bioparser::Parser<racon::Sequence>::Create<bioparser::FastaParser>(
+        std::string(TEST_DATA) + "sample_reference.fasta.gz");
+    auto reference = parser->Parse(-1);
+    EXPECT_EQ(reference.size(), 1);
+
+    EXPECT_EQ(1317, calculateEditDistance(
+        polished_sequences[0]->reverse_complement(),
+        reference[0]->data()));
+}
+
+TEST_F(RaconPolishingTest, ConsensusWithQualitiesAndAlignmentsCache) {
+    std::string cache_path = ::testing::TempDir() + "racon_test_cache.bin";
+    remove(cache_path.c_str());
+
+    auto reference_parser = bioparser::Parser<racon::Sequence>::Create<bioparser::FastaParser>(
+        std::string(TEST_DATA) + "sample_reference.fasta.gz");
+    auto reference = reference_parser->Parse(-1);
+    EXPECT_EQ(reference.size(), 1);
+
+    // first run stores breaking points, second one loads them
+    std::string consensus;
+    for (uint32_t i = 0; i < 2; ++i) {
+        SetUp(std::string(TEST_DATA) + "sample_reads.fastq.gz", std::string(TEST_DATA) +
+            "sample_overlaps.sam.gz", std::string(TEST_DATA) + "sample_layout.fasta.gz",
+            racon::PolisherType::kC, 500, 10, 0.3, 5, -4, -8, 0, false, 0, 0,
+            cache_path);
+
+        initialize();
+
+        std::vector<std::unique_ptr<racon::Sequence>> polished_sequences;
+        polish(polished_sequences, true);
+        EXPECT_EQ(polished_sequences.size(), 1);
+
+        polished_sequences[0]->create_reverse_complement();
+
+        EXPECT_EQ(1317, calculateEditDistance(
+            polished_sequences[0]->reverse_complement(),
+            reference[0]->data()));
+
+        if (i == 0) {
+            consensus = polished_sequences[0]->data();
+        } else {
+            EXPECT_EQ(consensus, polished_sequences[0]->data());
+        }
+    }
+
+    remove(cache_path.c_str());
+}
+
+TEST_F(RaconPolishingTest, ConsensusWithQualitiesLazyLoading) {
+    SetUp(std::string(TEST_DATA) + "sample_reads.fastq.gz", std::string(TEST_DATA) +
+        "sample_overlaps.paf.gz", std::string(TEST_DATA) + "sample_layout.fasta.gz",
+        racon::PolisherType::kC, 500, 10, 0.3, 5, -4, -8, 0, false, 0, 0, "",
+        true);
+
+    initialize();
+
+    std::vector<std::unique_ptr<racon::Sequence>> polished_sequences;
+    polish(polished_sequences, true);
+    EXPECT_EQ(polished_sequences.size(), 1);
+
+    polished_sequences[0]->create_reverse_complement();
+
+    auto parser = bioparser::Parser<racon::Sequence>::Create<bioparser::FastaParser>(
+        std::string(TEST_DATA) + "sample_reference.fasta.gz");
+    auto reference = parser->Parse(-1);
+    EXPECT_EQ(reference.size(), 1);
+
+    EXPECT_EQ(1312, calculateEditDistance(
+        polished_sequences[0]->reverse_complement(),
+        reference[0]->data()));
+}
+
+TEST_F(RaconPolishingTest, ConsensusWithQualitiesAndAlignmentsShards) {
+    auto parser = bioparser::Parser<racon::Sequence>::Create<bioparser::FastaParser>(
+        std::string(TEST_DATA) + "sample_reference.fasta.gz");
+    auto reference = parser->Parse(-1);
+    EXPECT_EQ(reference.size(), 1);
+
+    // the only target belongs to the second shard
+    for (uint32_t i = 0; i < 2; ++i) {
+        SetUp(std::string(TEST_DATA) + "sample_reads.fastq.gz", std::string(TEST_DATA) +
+            "sample_overlaps.sam.gz", std::string(TEST_DATA) + "sample_layout.fasta.gz",
+            racon::PolisherType::kC, 500, 10, 0.3, 5, -4, -8, 0, false, 0, 0, "",
+            false, i, 2);
+
+        initialize();
+
+        std::vector<std::unique_ptr<racon::Sequence>> polished_sequences;
+        polish(polished_sequences, false);
+        EXPECT_EQ(polished_sequences.size(), i);
+
+        if (i == 1) {
+            polished_sequences[0]->create_reverse_complement();
+            EXPECT_EQ(1317, calculateEditDistance(
+                polished_sequences[0]->reverse_complement(),
+                reference[0]->data()));
+        }
+    }
+}
+
+TEST_F(RaconPolishingTest, ConsensusWithQualitiesAndAlignmentsTargetSorted) {
+    SetUp(std::string(TEST_DATA) + "sample_reads.fastq.gz", std::string(TEST_DATA) +
+        "sample_overlaps.sam.gz", std::string(TEST_DATA) + "sample_layout.fasta.gz",
+        racon::PolisherType::kC, 500, 10, 0.3, 5, -4, -8, 0, false, 0, 0, "",
+        false, 0, 1, true);
+
+    initialize();
+
+    std::vector<std::unique_ptr<racon::Sequence>> polished_sequences;
+    polish(polished_sequences, true);
+    EXPECT_EQ(polished_sequences.size(), 1);
+
+    polished_sequences[0]->create_reverse_complement();
+
+    auto parser = bioparser::Parser<racon::Sequence>::Create<bioparser::FastaParser>(
+        std::string(TEST_DATA) + "sample_reference.fasta.gz");
+    auto reference = parser->Parse(-1);
+    EXPECT_EQ(reference.size(), 1);
+
+    EXPECT_EQ(1317, calculateEditDistance(
+        polished_sequences[0]->reverse_complement(),
+        reference[0]->data()));
+}
+
+TEST_F(RaconPolishingTest, ConsensusWithQualitiesAndAlignmentsMaxDepth) {
+    auto parser = bioparser::Parser<racon::Sequence>::Create<bioparser::FastaParser>(
+        std::string(TEST_DATA) + "sample_reference.fasta.gz");
+    auto reference = parser->Parse(-1);
+    EXPECT_EQ(reference.size(), 1);
+
+    // the automatic limit (twice the median coverage of targets but at least
+    // 60) is above the depth of all windows, a low limit has to drop layers
+    int32_t max_depths[] = {-1, 5};
+    uint32_t edit_distances[2] = {0, 0};
+    for (uint32_t i = 0; i < 2; ++i) {
+        SetUp(std::string(TEST_DATA) + "sample_reads.fastq.gz", std::string(TEST_DATA) +
+            "sample_overlaps.sam.gz", std::string(TEST_DATA) + "sample_layout.fasta.gz",
+            racon::PolisherType::kC, 500, 10, 0.3, 5, -4, -8, 0, false, 0, 0, "",
+            false, 0, 1, false, max_depths[i]);
+
+        initialize();
+
+        std::vector<std::unique_ptr<racon::Sequence>> polished_sequences;
+        polish(polished_sequences, true);
+        EXPECT_EQ(polished_sequences.size(), 1);
+
+        polished_sequences[0]->create_reverse_complement();
+        edit_distances[i] = calculateEditDistance(
+            polished_sequences[0]->reverse_complement(), reference[0]->data());
+    }
+
+    EXPECT_EQ(1317, edit_distances[0]);
+    EXPECT_GT(edit_distances[1], edit_distances[0]);
+}
+
+TEST_F(RaconPolishingTest, ConsensusWithQualitiesAndAlignmentsCacheMaxDepth) {
+    std::string cache_path = ::testing::TempDir() + "racon_test_cache.bin";
+    remove(cache_path.c_str());
+
+    // layers are ranked by overlap error which has to survive the cache
+    std::string consensus;
+    for (uint32_t i = 0; i < 2; ++i) {
+        SetUp(std::string(TEST_DATA) + "sample_reads.fastq.gz", std::string(TEST_DATA) +
+            "sample_overlaps.sam.gz", std::string(TEST_DATA) + "sample_layout.fasta.gz",
+            racon::PolisherType::kC, 500, 10, 0.3, 5, -4, -8, 0, false, 0, 0,
+            cache_path, false, 0, 1, false, 5);
+
+        initialize();
+
+        std::vector<std::unique_ptr<racon::Sequence>> polished_sequences;
+        polish(polished_sequences, true);
+        EXPECT_EQ(polished_sequences.size(), 1);
+
+        if (i == 0) {
+            consensus = polished_sequences[0]->data();
+        } else {
+            EXPECT_EQ(consensus, polished_sequences[0]->data());
+        }
+    }
+
+    remove(cache_path.c_str());
+}
+
+TEST_F(RaconPolishingTest, ConsensusWithQualitiesAndAlignmentsBanded) {
+    auto parser = bioparser::Parser<racon::Sequence>::Create<bioparser::FastaParser>(
+        std::string(TEST_DATA) + "sample_reference.fasta.gz");
+    auto reference = parser->Parse(-1);
+    EXPECT_EQ(reference.size(), 1);
+
+    // a band which is widened whenever it is reached yields the same
+    // consensus as the full alignment of spoa (band width 0)
+    uint32_t band_widths[] = {0, 128};
+    std::string consensuses[2];
+    for (uint32_t i = 0; i < 2; ++i) {
+        SetUp(std::string(TEST_DATA) + "sample_reads.fastq.gz", std::string(TEST_DATA) +
+            "sample_overlaps.sam.gz", std::string(TEST_DATA) + "sample_layout.fasta.gz",
+            racon::PolisherType::kC, 500, 10, 0.3, 5, -4, -8, 0, false, 0, 0, "",
+            false, 0, 1, false, 0, band_widths[i]);
+
+        initialize();
+
+        std::vector<std::unique_ptr<racon::Sequence>> polished_sequences;
+        polish(polished_sequences, true);
+        EXPECT_EQ(polished_sequences.size(), 1);
+
+        consensuses[i] = polished_sequences[0]->data();
+
+        polished_sequences[0]->create_reverse_complement();
+        EXPECT_EQ(1317, calculateEditDistance(
+            polished_sequences[0]->reverse_complement(), reference[0]->data()));
+    }
+
+    EXPECT_EQ(consensuses[0], consensuses[1]);
+}
+
+TEST_F(RaconPolishingTest, ConsensusAgreementThreshold) {
+    auto parser = bioparser::Parser<racon::Sequence>::Create<bioparser::FastaParser>(
+        std::string(TEST_DATA) + "sample_reference.fasta.gz");
+    auto reference = parser->Parse(-1);
+    EXPECT_EQ(reference.size(), 1);
+
+    // layers of raw reads rarely agree with the backbone
+    SetUp(std::string(TEST_DATA) + "sample_reads.fastq.gz", std::string(TEST_DATA) +
+        "sample_overlaps.sam.gz", std::string(TEST_DATA) + "sample_layout.fasta.gz",
+        racon::PolisherType::kC, 500, 10, 0.3, 5, -4, -8, 0, false, 0, 0, "",
+        false, 0, 1, false, 0, 0, 0.5);
+
+    initialize();
+
+    std::vector<std::unique_ptr<racon::Sequence>> polished_sequences;
+    polish(polished_sequences, true);
+    EXPECT_EQ(polished_sequences.size(), 1);
+
+    polished_sequences[0]->create_reverse_complement();
+    EXPECT_EQ(1317, calculateEditDistance(
+        polished_sequences[0]->reverse_complement(), reference[0]->data()));
+
+    // reads with sparse errors agree with a target which has a single
+    // planted substitution, its window still has to be polished
+    std::string genome;
+    for (uint32_t i = 0, x = 7; i < 6000; ++i) {
+        x = x * 1103515245 + 12345;
+        genome += "ACGT"[(x >> 16) & 3];
+    }
+    std::string target = genome;
+    target[2250] = target[2250] == 'A' ? 'C' : 'A';
+
+    std::string reads_path = ::testing::TempDir() + "racon_test_reads.fasta";
+    std::string overlaps_path = ::testing::TempDir() + "racon_test_overlaps.paf";
+    std::string target_path = ::testing::TempDir() + "racon_test_target.fasta";
+
+    FILE* reads_file = fopen(reads_path.c_str(), "w");
+    FILE* overlaps_file = fopen(overlaps_path.c_str(), "w");
+    for (uint32_t i = 0; i < 41; ++i) {
+        uint32_t begin = i * 100;
+        std::string read = genome.substr(begin, 2000);
+        for (const auto& it: {(i * 37) % 2000, (i * 53 + 1000) % 2000}) {
+            read[it] = read[it] == 'G' ? 'T' : 'G';
+        }
+        fprintf(reads_file, ">r%u\n%s\n", i, read.c_str());
+        fprintf(overlaps_file, "r%u\t2000\t0\t2000\t+\ttarget\t6000\t%u\t%u\t"
+            "2000\t2000\t60\n", i, begin, begin + 2000);
+    }
+    fclose(overlaps_file);
+    fclose(reads_file);
+
+    FILE* target_file = fopen(target_path.c_str(), "w");
+    fprintf(target_file, ">target\n%s\n", target.c_str());
+    fclose(target_file);
+
+    SetUp(reads_path, overlaps_path, target_path, racon::PolisherType::kC, 500,
+        10, 0.3, 5, -4, -8, 0, false, 0, 0, "", false, 0, 1, false, 0, 0, 0.5);
+
+    initialize();
+
+    polished_sequences.clear();
+    polish(polished_sequences, true);
+    EXPECT_EQ(polished_sequences.size(), 1);
+    EXPECT_NE(polished_sequences[0]->data().find(genome.substr(2000, 500)),
+        std::string::npos);
+
+    // an error-free target passes through unchanged without running POA,
+    // reads start at window boundaries so that all layers span their windows
+    reads_file = fopen(reads_path.c_str(), "w");
+    overlaps_file = fopen(overlaps_path.c_str(), "w");
+    for (uint32_t i = 0; i < 27; ++i) {
+        uint32_t begin = i / 3 * 500;
+        std::string read = genome.substr(begin, 2000);
+        for (const auto& it: {(i * 331) % 2000, (i * 577 + 1000) % 2000}) {
+            read[it] = read[it] == 'G' ? 'T' : 'G';
+        }
+        fprintf(reads_file, ">r%u\n%s\n", i, read.c_str());
+        fprintf(overlaps_file, "r%u\t2000\t0\t2000\t+\ttarget\t6000\t%u\t%u\t"
+            "2000\t2000\t60\n", i, begin, begin + 2000);
+    }
+    fclose(overlaps_file);
+    fclose(reads_file);
+
+    target_file = fopen(target_path.c_str(), "w");
+    fprintf(target_file, ">target\n%s\n", genome.c_str());
+    fclose(target_file);
+
+    SetUp(reads_path, overlaps_path, target_path, racon::PolisherType::kC, 500,
+        10, 0.3, 5, -4, -8, 0, false, 0, 0, "", false, 0, 1, false, 0, 0, 0.5);
+
+    initialize();
+
+    polished_sequences.clear();
+    ::testing::internal::CaptureStderr();
+    polish(polished_sequences, true);
+    std::string log = ::testing::internal::GetCapturedStderr();
+    EXPECT_EQ(polished_sequences.size(), 1);
+    EXPECT_EQ(polished_sequences[0]->data(), genome);
+    EXPECT_NE(log.find("kept backbones of 12 windows"), std::string::npos);
+
+    remove(reads_path.c_str());
+    remove(overlaps_path.c_str());
+    remove(target_path.c_str());
+}
+
 #ifdef CUDA_ENABLED
 TEST_F(RaconPolishingTest, ConsensusWithQualitiesCUDA) {
     SetUp(std::string(TEST_DATA) + "sample_reads.fastq.gz", std::string(TEST_DATA) +